@@ -0,0 +1,143 @@
+/*
+ * arena.c
+ * Reusable scratch memory for the image search.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+
+// Size of the first block; later blocks are at least twice the previous one
+#define INITIAL_BLOCK_SIZE 65536
+
+/*
+ * Creates an empty arena. Returns NULL if it cannot be allocated
+ */
+scratchArena *newScratchArena(void)
+{
+	scratchArena *arena = malloc(sizeof(scratchArena));
+	if (arena == NULL)
+		return NULL;
+	
+	arena->first = malloc(sizeof(arenaBlock) + INITIAL_BLOCK_SIZE);
+	if (arena->first == NULL)
+	{
+		free(arena);
+		return NULL;
+	}
+	arena->first->next = NULL;
+	arena->first->size = INITIAL_BLOCK_SIZE;
+	arena->first->used = 0;
+	arena->current = arena->first;
+	return arena;
+}
+
+/*
+ * Releases an arena and all of its blocks
+ */
+void freeScratchArena(scratchArena *arena)
+{
+	if (arena == NULL)
+		return;
+	
+	arenaBlock *b = arena->first;
+	while (b != NULL)
+	{
+		arenaBlock *next = b->next;
+		free(b);
+		b = next;
+	}
+	free(arena);
+}
+
+/*
+ * Allocates bytes from the arena, aligned for any of the search types.
+ * Returns NULL if there is not enough memory
+ */
+void *arenaAlloc(scratchArena *arena, size_t bytes)
+{
+	if (arena == NULL)
+		return NULL;
+	
+	bytes = (bytes + 15) & ~(size_t)15;
+	arenaBlock *b = arena->current;
+	if (b->size - b->used < bytes)
+	{
+		// Move on to the next block, replacing it if it is too small
+		arenaBlock *next = b->next;
+		if (next == NULL || next->size < bytes)
+		{
+			size_t size = 2*b->size;
+			while (size < bytes)
+				size *= 2;
+			
+			arenaBlock *n = malloc(sizeof(arenaBlock) + size);
+			if (n == NULL)
+				return NULL;
+			n->size = size;
+			n->next = next;
+			if (next != NULL)
+			{
+				n->next = next->next;
+				free(next);
+			}
+			b->next = n;
+			next = n;
+		}
+		next->used = 0;
+		arena->current = b = next;
+	}
+	
+	void *p = (char *)b->data + b->used;
+	b->used += bytes;
+	return p;
+}
+
+/*
+ * Returns the current position of the arena, to be released back to later
+ */
+arenaMark arenaGetMark(scratchArena *arena)
+{
+	arenaMark mark = {NULL, 0};
+	if (arena != NULL)
+	{
+		mark.block = arena->current;
+		mark.used = arena->current->used;
+	}
+	return mark;
+}
+
+/*
+ * Frees everything allocated since the mark was taken
+ */
+void arenaRelease(scratchArena *arena, arenaMark mark)
+{
+	if (arena == NULL || mark.block == NULL)
+		return;
+	arena->current = mark.block;
+	arena->current->used = mark.used;
+}
@@ -0,0 +1,63 @@
+/*
+ * arena.h
+ * Reusable scratch memory for the image search.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef ARENA_HEADER
+#define ARENA_HEADER
+
+#include <stddef.h>
+
+/*
+ * A stack of memory blocks. Allocations are released in bulk by returning to
+ * an earlier mark, and the blocks are kept for the next allocations, so a
+ * search allocates nothing once its arena has grown to the size it needs.
+ */
+typedef struct arenaBlock {
+	struct arenaBlock *next;
+	size_t size;
+	size_t used;
+	double data[];
+} arenaBlock;
+
+typedef struct scratchArena {
+	arenaBlock *first;
+	arenaBlock *current;
+} scratchArena;
+
+typedef struct arenaMark {
+	arenaBlock *block;
+	size_t used;
+} arenaMark;
+
+// Function declarations
+scratchArena *newScratchArena(void);
+void freeScratchArena(scratchArena *arena);
+void *arenaAlloc(scratchArena *arena, size_t bytes);
+arenaMark arenaGetMark(scratchArena *arena);
+void arenaRelease(scratchArena *arena, arenaMark mark);
+#endif
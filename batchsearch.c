@@ -0,0 +1,184 @@
+/*
+ * batchsearch.c
+ * Image search for many source positions in one traversal.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "batchsearch.h"
+#include "arena.h"
+#include "searchstats.h"
+
+/*
+ * The frames of a batch, and the image area found so far for each
+ */
+typedef struct frameBatch {
+	source *sources;
+	double *areas;
+	int numFrames;
+} frameBatch;
+
+static void searchFrames(searchGrid grid, frameBatch *batch, frameMask frames);
+
+/*
+ * Continues the search of some frames into the quadrants of the grid
+ */
+static void divideFrames(searchGrid grid, frameBatch *batch, frameMask frames)
+{
+	int i;
+	for (i=0; i < 4; i++)
+		searchFrames(childGrid(grid, i), batch, frames);
+}
+
+/*
+ * Finds the images in a given area for each frame in frames, as search() does
+ * for a single source. The divergence checks do not depend on the source and
+ * are made once; the cell is bounded and its boundary mapped once, then
+ * tested against each frame's source. Only the frames that still overlap the
+ * cell are carried into its children
+ */
+static void searchFrames(searchGrid grid, frameBatch *batch, frameMask frames)
+{
+	boolean atResolution = gridAtResolution(grid);
+	countCell(grid, STAT_VISITED);
+	
+	if (grid.checkLenses)
+	{
+		if (containsLens(grid))
+		{
+			countCell(grid, STAT_LENS);
+			if (!atResolution)
+				divideFrames(grid, batch, frames);
+			return;
+		}
+		grid.checkLenses = FALSE;
+	}
+	
+	if (grid.checkCriticalCurve)
+	{
+		if (straddlesCriticalCurve(grid))
+		{
+			countCell(grid, STAT_CRITICAL_CURVE);
+			if (!atResolution)
+				divideFrames(grid, batch, frames);
+			return;
+		}
+		grid.checkCriticalCurve = FALSE;
+	}
+	
+	double area = grid.searchArea.size*grid.searchArea.size;
+	double minU, minV, maxU, maxV;
+	boundGridImage(grid, &minU, &minV, &maxU, &maxV);
+	grid.context->calculations[grid.level] += 40;
+	
+	// Frames whose source the bound misses are finished with this cell
+	frameMask overlapping = 0;
+	int f;
+	for (f=0; f < batch->numFrames; f++)
+	{
+		if (!(frames & ((frameMask)1 << f)))
+			continue;
+		if (boxClearOfSource(minU, minV, maxU, maxV, &batch->sources[f]))
+			grid.context->eliminated[grid.level] += area;
+		else
+			overlapping |= (frameMask)1 << f;
+	}
+	if (overlapping == 0)
+		return;
+	
+	arenaMark mark = arenaGetMark(grid.context->arena);
+	point *vt;
+	int vC = mapBoundary(grid, &vt);
+	
+	frameMask divide = 0;
+	for (f=0; f < batch->numFrames; f++)
+	{
+		if (!(overlapping & ((frameMask)1 << f)))
+			continue;
+		
+		// Without a boundary the cell is assumed to overlap, so that it is divided
+		intersectionType hit = (vC > 0) ? testPolygonAgainstSource(vt, vC, &batch->sources[f]) : OVERLAP;
+		if (hit == NO_OVERLAP || hit == INSIDE_SOURCE || atResolution)
+		{
+			grid.context->eliminated[grid.level] += area;
+			if (hit != NO_OVERLAP)
+				batch->areas[f] += area;
+		}
+		else
+			divide |= (frameMask)1 << f;
+	}
+	arenaRelease(grid.context->arena, mark);
+	
+	if (divide != 0)
+		divideFrames(grid, batch, divide);
+}
+
+/*
+ * Finds the image area of each of numSources sources, searching
+ * MAX_BATCH_FRAMES of them per traversal of the quadtree. Each cell is mapped
+ * once per traversal however many frames it is tested against. The areas
+ * match those from separate calls to searchImages(). The counters in context
+ * cover the whole batch; leaf cells are not recorded
+ */
+void searchAreasBatch(searchArea a, source *sources, int numSources, event *event, searchContext *context, double *areas)
+{
+	beginSearch(a, event, context);
+	
+	int first;
+	for (first=0; first < numSources; first += MAX_BATCH_FRAMES)
+	{
+		frameBatch batch;
+		batch.sources = sources + first;
+		batch.areas = areas + first;
+		batch.numFrames = (numSources - first < MAX_BATCH_FRAMES) ? numSources - first : MAX_BATCH_FRAMES;
+		
+		int f;
+		for (f=0; f < batch.numFrames; f++)
+			batch.areas[f] = 0;
+		
+		frameMask frames = (batch.numFrames == MAX_BATCH_FRAMES) ? ~(frameMask)0 : ((frameMask)1 << batch.numFrames) - 1;
+		searchFrames(makeSearchGrid(a, &sources[first], event, context, TRUE, TRUE, 1), &batch, frames);
+	}
+	endSearch(context);
+}
+
+/*
+ * Finds the magnification (image area over source area) of each of numSources
+ * sources in a few traversals, so a lightcurve costs much less than one search
+ * per point
+ */
+void searchImagesBatch(searchArea a, source *sources, int numSources, event *event, searchContext *context, double *magnifications)
+{
+	searchAreasBatch(a, sources, numSources, event, context, magnifications);
+	
+	int i;
+	for (i=0; i < numSources; i++)
+		magnifications[i] /= PI*sources[i].radius*sources[i].radius;
+}
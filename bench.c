@@ -0,0 +1,749 @@
+/*
+ * bench.c
+ * Headless benchmark of the image search over fixed scenarios.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "deflection.h"
+#include "searchstats.h"
+#include "contour.h"
+#include "lightcurve.h"
+#include "magnificationmap.h"
+#include "rayshoot.h"
+
+#define FIELD_SEED 1
+
+// Time spent timing the deflection kernel on its own
+#define KERNEL_SECONDS 0.2
+#define KERNEL_POINTS 4096
+
+// Ray shooting cross-check: the noise aimed for, and the most rays shot per scenario
+#define RAY_NOISE 0.03
+#define MAX_RAYS (4096.0*4096.0)
+
+// Random polygons for the classifier cross-check
+#define CLASSIFIER_SEED 2
+#define CLASSIFIER_POLYGONS 20000
+#define CLASSIFIER_MAX_VERTICES 48
+
+typedef enum lensModel {
+	SINGLE_LENS = 0,
+	BINARY_LENS = 1,
+	LENS_FIELD = 2		// Equal masses scattered over the window, total mass 1
+} lensModel;
+
+/*
+ * A fixed search workload: a source moving along a straight path
+ */
+typedef struct benchScenario {
+	const char *name;
+	lensModel model;
+	int numLenses;
+	double openingAngle;
+	double resolution;
+	double sourceRadius;
+	point start;
+	point end;
+	int frames;
+	searchArea window;
+} benchScenario;
+
+typedef struct benchResult {
+	int frames;
+	double seconds;
+	long deflections;
+	long cellsVisited;
+	double totalArea;
+	double kernelNsPerDeflection;
+	long peakMemoryKB;
+} benchResult;
+
+/*
+ * The scenarios. The binary event is the one shown by the viewer; the
+ * caustic crossing moves a small source across its planetary caustic
+ */
+static const benchScenario scenarios[] = {
+	{"singleLens", SINGLE_LENS, 1, 0, 1e-3, 0.05, {-1, 0.1}, {1, 0.1}, 21, {-2, -2, 4}},
+	{"binaryEvent", BINARY_LENS, 2, 0, 1e-2, 0.05, {1.5, -0.17}, {1.875, -0.17}, 101, {-1, -2, 4}},
+	{"causticCrossing", BINARY_LENS, 2, 0, 1e-3, 0.01, {1.6, -0.17}, {1.76, -0.17}, 21, {-1, -2, 4}},
+	{"smallSourceFine", BINARY_LENS, 2, 0, 1e-4, 0.002, {0.2, -0.17}, {0.4, -0.17}, 5, {-1, -2, 4}},
+	{"lensField", LENS_FIELD, 200, 0, 2e-3, 0.05, {-0.5, 0.05}, {2.5, 0.05}, 7, {-1, -2, 4}}
+};
+#define NUM_SCENARIOS (int)(sizeof(scenarios)/sizeof(scenarios[0]))
+
+/*
+ * Areas for the outline check: the viewer's, and one whose origin and size
+ * are not dyadic, so that cell corners are not exact sums of cell sizes
+ */
+static const searchArea contourAreas[] = {{-1, -2, 4}, {-1.3, -1.7, 4.1}};
+static const double contourResolutions[] = {1e-2, 3e-3};
+#define NUM_CONTOUR_AREAS (int)(sizeof(contourAreas)/sizeof(contourAreas[0]))
+#define NUM_CONTOUR_RESOLUTIONS (int)(sizeof(contourResolutions)/sizeof(contourResolutions[0]))
+
+/*
+ * Image area of a scenario's middle frame from the quadtree and from ray shooting
+ */
+typedef struct rayResult {
+	double searchArea;
+	double searchSeconds;
+	double rayArea;
+	double raySeconds;
+	double noise;
+	long rays;
+} rayResult;
+
+typedef intersectionType (*polygonClassifier)(point *v, int vp, source *source);
+
+typedef struct classifierResult {
+	const char *name;
+	double nsPerTest;
+	long disagreements;		// Polygons classed differently from the exact reference
+	long overRefined;		// OVERLAP where the reference finds none, so the cell is divided needlessly
+	long underRefined;		// No OVERLAP where the reference finds one, so image area is lost
+} classifierResult;
+
+/*
+ * Seconds on the monotonic clock
+ */
+static double benchClock(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+/*
+ * Places the lenses of a scenario
+ */
+static void makeScenarioLenses(const benchScenario *b, lens *lenses)
+{
+	int i;
+	switch (b->model)
+	{
+		case SINGLE_LENS:
+			lenses[0] = makeLens(makePoint(0, 0), 1);
+			break;
+		case BINARY_LENS:
+			lenses[0] = makeLens(makePoint(0, 0), 1.0/1.5);
+			lenses[1] = makeLens(makePoint(2, 0), 0.5/1.5);
+			break;
+		case LENS_FIELD:
+			srand48(FIELD_SEED);
+			for (i=0; i < b->numLenses; i++)
+				lenses[i] = makeLens(makePoint(b->window.x + drand48()*b->window.size, b->window.y + drand48()*b->window.size), 1.0/b->numLenses);
+			break;
+	}
+}
+
+/*
+ * Times the deflection kernel alone on a grid of points over the window
+ */
+static double kernelNsPerDeflection(event *e, searchArea window)
+{
+	point in[KERNEL_POINTS];
+	point out[KERNEL_POINTS];
+	int side = 64;
+	int i;
+	for (i=0; i < KERNEL_POINTS; i++)
+		in[i] = makePoint(window.x + (i % side + 0.5)*window.size/side, window.y + (i/side + 0.5)*window.size/side);
+	
+	long count = 0;
+	double start = benchClock();
+	double elapsed;
+	do
+	{
+		deflectPoints(e, in, out, KERNEL_POINTS);
+		count += KERNEL_POINTS;
+		elapsed = benchClock() - start;
+	} while (elapsed < KERNEL_SECONDS);
+	return 1e9*elapsed/count;
+}
+
+/*
+ * Runs one scenario with a serial search, in the current process
+ */
+static boolean runScenario(const benchScenario *b, benchResult *result)
+{
+	lens *lenses = malloc(b->numLenses*sizeof(lens));
+	searchStats *stats = newSearchStats();
+	if (lenses == NULL || stats == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate scenario %s\n", b->name);
+		free(lenses);
+		freeSearchStats(stats);
+		return FALSE;
+	}
+	makeScenarioLenses(b, lenses);
+	event e = makeEvent(b->numLenses, lenses, b->resolution);
+	setOpeningAngle(&e, b->openingAngle);
+	
+	searchContext context;
+	initSearchContext(&context, FALSE);
+	context.stats = stats;
+	memset(result, 0, sizeof(benchResult));
+	
+	double start = benchClock();
+	int f;
+	for (f=0; f < b->frames; f++)
+	{
+		source s = makeSource(interpolatePosition(b->start, b->end, (b->frames > 1) ? f/(double)(b->frames - 1) : 0), b->sourceRadius);
+		result->totalArea += searchImages(b->window, &s, &e, &context);
+		result->deflections += context.deflections;
+	}
+	result->seconds = benchClock() - start;
+	result->frames = b->frames;
+	
+	int i;
+	for (f=0; f < stats->numFrames; f++)
+		for (i=0; i < MAX_SEARCH_LEVELS; i++)
+			result->cellsVisited += stats->frames[f].levels[i].cells[STAT_VISITED];
+	
+	result->kernelNsPerDeflection = kernelNsPerDeflection(&e, b->window);
+	
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		result->peakMemoryKB = usage.ru_maxrss;
+	
+	freeSearchContext(&context);
+	freeSearchStats(stats);
+	freeEvent(&e);
+	free(lenses);
+	return TRUE;
+}
+
+/*
+ * Runs a scenario in a child process, so that its peak memory is its own.
+ * Runs it here if the child cannot be started
+ */
+static boolean runScenarioIsolated(const benchScenario *b, benchResult *result)
+{
+	int fd[2];
+	if (pipe(fd) != 0)
+		return runScenario(b, result);
+	
+	fflush(stdout);
+	pid_t child = fork();
+	if (child < 0)
+	{
+		close(fd[0]);
+		close(fd[1]);
+		return runScenario(b, result);
+	}
+	
+	if (child == 0)
+	{
+		close(fd[0]);
+		boolean ok = runScenario(b, result) && write(fd[1], result, sizeof(benchResult)) == sizeof(benchResult);
+		close(fd[1]);
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	
+	close(fd[1]);
+	boolean ok = (read(fd[0], result, sizeof(benchResult)) == sizeof(benchResult));
+	close(fd[0]);
+	
+	int status;
+	waitpid(child, &status, 0);
+	return ok && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/*
+ * Cross-checks searchImages() against shootImageArea() on the middle frame of
+ * a scenario, both on one thread. Rays are shot over the whole window at a
+ * density that puts 1/RAY_NOISE^2 of them in the unlensed source, or fewer
+ * if that would take more than MAX_RAYS. Returns FALSE if out of memory
+ */
+static boolean runRayCheck(const benchScenario *b, rayResult *result)
+{
+	lens *lenses = malloc(b->numLenses*sizeof(lens));
+	if (lenses == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate scenario %s\n", b->name);
+		return FALSE;
+	}
+	makeScenarioLenses(b, lenses);
+	event e = makeEvent(b->numLenses, lenses, b->resolution);
+	setOpeningAngle(&e, b->openingAngle);
+	source s = makeSource(interpolatePosition(b->start, b->end, 0.5), b->sourceRadius);
+	
+	searchContext context;
+	initSearchContext(&context, FALSE);
+	double start = benchClock();
+	result->searchArea = searchImages(b->window, &s, &e, &context);
+	result->searchSeconds = benchClock() - start;
+	
+	// Rays per unlensed source area is 1/noise^2
+	double sourceArea = PI*s.radius*s.radius;
+	result->noise = RAY_NOISE;
+	if (b->window.size*b->window.size/(sourceArea*RAY_NOISE*RAY_NOISE) > MAX_RAYS)
+		result->noise = b->window.size/sqrt(sourceArea*MAX_RAYS);
+	
+	rayStats stats = {0, 0, 0};
+	start = benchClock();
+	result->rayArea = shootImageArea(b->window, &s, &e, result->noise, 1, &stats);
+	result->raySeconds = benchClock() - start;
+	result->rays = stats.rays;
+	
+	freeSearchContext(&context);
+	freeEvent(&e);
+	free(lenses);
+	return result->rayArea >= 0;
+}
+
+/*
+ * Exact reference for testPolygonAgainstSource(): each edge is intersected
+ * with the source circle by solving the quadratic for the crossing points.
+ * A vertex lying on the ray from the source centre is counted as a crossing
+ * by the edge ending there, even if the boundary only touches the ray.
+ */
+static intersectionType exactPolygonAgainstSource(point *v, int vp, source *source)
+{
+	boolean polygonEnclosedInSource = TRUE;
+	boolean hit = FALSE;
+	int edgeHits = 0;
+	int i;
+	for (i=0; i < vp; i++)
+	{
+		if (hypot(v[i].x - source->origin.x, v[i].y - source->origin.y) <= source->radius)
+			hit = TRUE;
+		else
+			polygonEnclosedInSource = FALSE;
+	}
+	if (polygonEnclosedInSource)
+		return INSIDE_SOURCE;
+	if (hit)
+		return OVERLAP;
+	
+	for (i=0; i < vp; i++)
+	{
+		double u1 = v[i].x;
+		double v1 = v[i].y;
+		double du = v[(i+1) % vp].x - u1;
+		double dv = v[(i+1) % vp].y - v1;
+		double dux = u1 - source->origin.x;
+		double dvy = v1 - source->origin.y;
+		
+		// Does the ray upwards from the source centre cross this edge?
+		double p = -dux/du;
+		if (0 < p && p <= 1 && (v1 + p*dv >= source->origin.y))
+			edgeHits++;
+		
+		// Does the edge cross the source circle?
+		double a = du*du + dv*dv;
+		double b = 2*(du*dux + dv*dvy);
+		double c = dux*dux + dvy*dvy - source->radius*source->radius;
+		double d = b*b - 4*a*c;
+		if (d < 0)
+			continue;
+		double p1 = (-b + sqrt(d))/(2*a);
+		double p2 = (-b - sqrt(d))/(2*a);
+		if ((0 <= p1 && p1 <= 1) || (0 <= p2 && p2 <= 1))
+			return OVERLAP;
+	}
+	return (edgeHits % 2) ? ENCLOSES_SOURCE : NO_OVERLAP;
+}
+
+/*
+ * Conservative classifier that takes the source to meet an edge whenever it
+ * comes within the edge's length of the edge's first vertex
+ */
+static intersectionType nearbyPolygonAgainstSource(point *v, int vC, source *source)
+{
+	boolean totallyInsideSource = TRUE;
+	boolean partiallyInsideSource = FALSE;
+	int windingNumber = 0;
+	int i;
+	for (i=0; i < vC; i++)
+	{
+		point tv = v[i];
+		point nv = v[(i+1) % vC];
+		point sp = source->origin;
+		
+		if (lineOnRightOfPoint(tv, nv, sp))
+		{
+			if (tv.y > sp.y && nv.y <= sp.y) // Downward crossing
+				windingNumber--;
+			else if (tv.y <= sp.y && nv.y > sp.y) // Upward crossing
+				windingNumber++;
+		}
+		
+		double vd = hypot(tv.x - sp.x, tv.y - sp.y);
+		if (vd <= source->radius)
+		{
+			partiallyInsideSource = TRUE;
+			if (!totallyInsideSource)
+				return OVERLAP;
+			continue;
+		}
+		totallyInsideSource = FALSE;
+		if (partiallyInsideSource)
+			return OVERLAP;
+		
+		if (vd <= source->radius + hypot(tv.x - nv.x, tv.y - nv.y))
+			return OVERLAP;
+	}
+	
+	if (totallyInsideSource)
+		return INSIDE_SOURCE;
+	return (windingNumber != 0) ? ENCLOSES_SOURCE : NO_OVERLAP;
+}
+
+/*
+ * Fills polygons like mapped cell boundaries: star shaped, of 4 to
+ * CLASSIFIER_MAX_VERTICES vertices, from much smaller to much larger than
+ * their source, which is placed so that all four classes are common
+ */
+static void makeClassifierPolygons(point *vertices, int *numVertices, source *sources, int count)
+{
+	srand48(CLASSIFIER_SEED);
+	int i, j;
+	for (i=0; i < count; i++)
+	{
+		double radius = 0.02*exp(drand48()*log(100.0));
+		point centre = makePoint((2*drand48() - 1)*1.5*radius, (2*drand48() - 1)*1.5*radius);
+		numVertices[i] = 4 + (int)(drand48()*(CLASSIFIER_MAX_VERTICES - 3));
+		point *v = &vertices[i*CLASSIFIER_MAX_VERTICES];
+		for (j=0; j < numVertices[i]; j++)
+		{
+			double angle = 2*PI*(j + 0.8*drand48())/numVertices[i];
+			double r = radius*(0.7 + 0.6*drand48());
+			v[j] = makePoint(centre.x + r*cos(angle), centre.y + r*sin(angle));
+		}
+		sources[i] = makeSource(makePoint(0, 0), 0.02*exp(drand48()*log(25.0)));
+	}
+}
+
+/*
+ * Times a classifier over the polygons, and compares its classes with the reference
+ */
+static void runClassifier(polygonClassifier classify, point *vertices, int *numVertices, source *sources,
+	const intersectionType *reference, int count, classifierResult *result)
+{
+	int i;
+	result->disagreements = result->overRefined = result->underRefined = 0;
+	for (i=0; i < count; i++)
+	{
+		intersectionType hit = classify(&vertices[i*CLASSIFIER_MAX_VERTICES], numVertices[i], &sources[i]);
+		if (hit == reference[i])
+			continue;
+		result->disagreements++;
+		if (hit == OVERLAP)
+			result->overRefined++;
+		else if (reference[i] == OVERLAP)
+			result->underRefined++;
+	}
+	
+	long tests = 0;
+	volatile int sink = 0;
+	double start = benchClock();
+	double elapsed;
+	do
+	{
+		for (i=0; i < count; i++)
+			sink += classify(&vertices[i*CLASSIFIER_MAX_VERTICES], numVertices[i], &sources[i]);
+		tests += count;
+		elapsed = benchClock() - start;
+	} while (elapsed < KERNEL_SECONDS);
+	result->nsPerTest = 1e9*elapsed/tests;
+}
+
+/*
+ * Cross-checks testPolygonAgainstSource() and the conservative classifier
+ * against the exact reference on random polygons. Returns FALSE if the
+ * polygons cannot be allocated or testPolygonAgainstSource() loses image area
+ */
+static boolean runClassifierCheck(classifierResult *results, int *numResults)
+{
+	int count = CLASSIFIER_POLYGONS;
+	point *vertices = malloc(count*CLASSIFIER_MAX_VERTICES*sizeof(point));
+	int *numVertices = malloc(count*sizeof(int));
+	source *sources = malloc(count*sizeof(source));
+	intersectionType *reference = malloc(count*sizeof(intersectionType));
+	if (vertices == NULL || numVertices == NULL || sources == NULL || reference == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate classifier polygons\n");
+		free(vertices);
+		free(numVertices);
+		free(sources);
+		free(reference);
+		return FALSE;
+	}
+	makeClassifierPolygons(vertices, numVertices, sources, count);
+	
+	long classes[OVERLAP + 1];
+	int i;
+	memset(classes, 0, sizeof(classes));
+	for (i=0; i < count; i++)
+	{
+		reference[i] = exactPolygonAgainstSource(&vertices[i*CLASSIFIER_MAX_VERTICES], numVertices[i], &sources[i]);
+		classes[reference[i]]++;
+	}
+	printf("\nClassifier check on %d polygons (%ld no overlap, %ld overlap, %ld inside, %ld enclosing)\n",
+		count, classes[NO_OVERLAP], classes[OVERLAP], classes[INSIDE_SOURCE], classes[ENCLOSES_SOURCE]);
+	
+	const char *names[3] = {"exact", "fast", "nearby"};
+	polygonClassifier classifiers[3] = {exactPolygonAgainstSource, testPolygonAgainstSource, nearbyPolygonAgainstSource};
+	printf("%-16s %10s %12s %12s %12s\n", "classifier", "ns/test", "differ", "over", "under");
+	for (i=0; i < 3; i++)
+	{
+		results[i].name = names[i];
+		runClassifier(classifiers[i], vertices, numVertices, sources, reference, count, &results[i]);
+		printf("%-16s %10.2f %12ld %12ld %12ld\n", results[i].name, results[i].nsPerTest,
+			results[i].disagreements, results[i].overRefined, results[i].underRefined);
+	}
+	*numResults = 3;
+	
+	free(vertices);
+	free(numVertices);
+	free(sources);
+	free(reference);
+	return results[1].underRefined == 0;
+}
+
+/*
+ * Contours the images of the binary event, which lie well inside the search
+ * areas, and counts the outlines that do not close. Returns FALSE if any is open
+ */
+static boolean runContourCheck(void)
+{
+	lens lenses[2];
+	benchScenario binary = scenarios[1];
+	makeScenarioLenses(&binary, lenses);
+	source s = makeSource(makePoint(1.6, -0.17), 0.05);
+	boolean ok = TRUE;
+	
+	printf("\nOutline check\n");
+	printf("%8s %8s %8s %10s %12s %10s %10s\n", "x", "y", "size", "resolution", "image area", "outlines", "open");
+	int i, j, k;
+	for (i=0; i < NUM_CONTOUR_AREAS; i++)
+	{
+		for (j=0; j < NUM_CONTOUR_RESOLUTIONS; j++)
+		{
+			event e = makeEvent(2, lenses, contourResolutions[j]);
+			searchContext context;
+			contourSet contours;
+			initSearchContext(&context, FALSE);
+			initContourSet(&contours);
+			
+			searchArea a = contourAreas[i];
+			double area = searchImageContours(a, &s, &e, &context, &contours);
+			int open = 0;
+			for (k=0; k < contours.numOutlines; k++)
+			{
+				point first = contours.points[contours.starts[k]];
+				point last = contours.points[contours.starts[k + 1] - 1];
+				if (first.x != last.x || first.y != last.y)
+					open++;
+			}
+			printf("%8.2f %8.2f %8.2f %10.0e %12.8f %10d %10d\n", a.x, a.y, a.size, contourResolutions[j],
+				area, contours.numOutlines, open);
+			ok = ok && contours.numOutlines > 0 && open == 0;
+			
+			freeContourSet(&contours);
+			freeSearchContext(&context);
+			freeEvent(&e);
+		}
+	}
+	return ok;
+}
+
+/*
+ * Writes the results as JSON, for tracking between versions
+ */
+static boolean writeBenchJSON(const char *filename, const benchResult *results, const boolean *ran,
+	const rayResult *rays, const boolean *rayRan, const classifierResult *classifiers, int numClassifiers)
+{
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	fprintf(out, "{\"kernel\": \"%s\", \"scenarios\": [", deflectionKernelName());
+	boolean first = TRUE;
+	int i;
+	for (i=0; i < NUM_SCENARIOS; i++)
+	{
+		if (!ran[i])
+			continue;
+		const benchResult *r = &results[i];
+		fprintf(out, "%s\n  {\"name\": \"%s\", \"frames\": %d, \"seconds\": %.6f, \"framesPerSecond\": %.3f, \"deflections\": %ld, "
+			"\"nsPerDeflection\": %.3f, \"kernelNsPerDeflection\": %.3f, \"cellsVisited\": %ld, \"cellsPerSecond\": %.0f, "
+			"\"peakMemoryKB\": %ld, \"totalArea\": %.12g}",
+			first ? "" : ",", scenarios[i].name, r->frames, r->seconds, r->frames/r->seconds, r->deflections,
+			1e9*r->seconds/r->deflections, r->kernelNsPerDeflection, r->cellsVisited, r->cellsVisited/r->seconds,
+			r->peakMemoryKB, r->totalArea);
+		first = FALSE;
+	}
+	fprintf(out, "\n], \"rayShooting\": [");
+	first = TRUE;
+	for (i=0; i < NUM_SCENARIOS; i++)
+	{
+		if (!rayRan[i])
+			continue;
+		const rayResult *r = &rays[i];
+		fprintf(out, "%s\n  {\"name\": \"%s\", \"searchArea\": %.12g, \"searchSeconds\": %.6f, \"rayArea\": %.12g, "
+			"\"raySeconds\": %.6f, \"rays\": %ld, \"noise\": %.4g}",
+			first ? "" : ",", scenarios[i].name, r->searchArea, r->searchSeconds, r->rayArea, r->raySeconds, r->rays, r->noise);
+		first = FALSE;
+	}
+	fprintf(out, "\n], \"classifiers\": [");
+	for (i=0; i < numClassifiers; i++)
+	{
+		const classifierResult *c = &classifiers[i];
+		fprintf(out, "%s\n  {\"name\": \"%s\", \"nsPerTest\": %.3f, \"disagreements\": %ld, \"overRefined\": %ld, \"underRefined\": %ld}",
+			(i > 0) ? "," : "", c->name, c->nsPerTest, c->disagreements, c->overRefined, c->underRefined);
+	}
+	fprintf(out, "\n]}\n");
+	return fclose(out) == 0;
+}
+
+/*
+ * Usage: benchmark [-o results.json] [scenario ...] [rays] [classifier] [contour]
+ * Runs the named scenarios, the ray shooting cross-check of every scenario,
+ * and the classifier and outline checks (all by default),
+ * printing tables, and writes the results as JSON if asked
+ */
+int main(int argc, char **argv)
+{
+	const char *jsonFile = NULL;
+	boolean selected[NUM_SCENARIOS];
+	boolean anySelected = FALSE;
+	boolean classifierSelected = FALSE;
+	boolean contourSelected = FALSE;
+	boolean raysSelected = FALSE;
+	int i, j;
+	memset(selected, 0, sizeof(selected));
+	
+	for (i=1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			jsonFile = argv[++i];
+			continue;
+		}
+		if (strcmp(argv[i], "classifier") == 0)
+		{
+			classifierSelected = anySelected = TRUE;
+			continue;
+		}
+		if (strcmp(argv[i], "rays") == 0)
+		{
+			raysSelected = anySelected = TRUE;
+			continue;
+		}
+		if (strcmp(argv[i], "contour") == 0)
+		{
+			contourSelected = anySelected = TRUE;
+			continue;
+		}
+		for (j=0; j < NUM_SCENARIOS && strcmp(argv[i], scenarios[j].name) != 0; j++);
+		if (j == NUM_SCENARIOS)
+		{
+			fprintf(stderr, "Error: unknown scenario %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+		selected[j] = anySelected = TRUE;
+	}
+	
+	benchResult results[NUM_SCENARIOS];
+	boolean ran[NUM_SCENARIOS];
+	boolean ok = TRUE;
+	
+	printf("Kernel: %s\n", deflectionKernelName());
+	printf("%-16s %7s %10s %12s %10s %12s %10s %12s\n", "scenario", "frames", "fps", "deflections", "ns/defl", "kernel ns", "cells/s", "peak KB");
+	for (i=0; i < NUM_SCENARIOS; i++)
+	{
+		ran[i] = FALSE;
+		if (anySelected && !selected[i])
+			continue;
+		
+		benchResult *r = &results[i];
+		ran[i] = runScenarioIsolated(&scenarios[i], r);
+		if (!ran[i])
+		{
+			fprintf(stderr, "Error: scenario %s failed\n", scenarios[i].name);
+			ok = FALSE;
+			continue;
+		}
+		printf("%-16s %7d %10.2f %12ld %10.2f %12.2f %10.3g %12ld\n", scenarios[i].name, r->frames, r->frames/r->seconds,
+			r->deflections, 1e9*r->seconds/r->deflections, r->kernelNsPerDeflection, r->cellsVisited/r->seconds, r->peakMemoryKB);
+		fflush(stdout);
+	}
+	
+	rayResult rays[NUM_SCENARIOS];
+	boolean rayRan[NUM_SCENARIOS];
+	memset(rayRan, 0, sizeof(rayRan));
+	if (!anySelected || raysSelected)
+	{
+		printf("\nRay shooting cross-check (middle frame, one thread)\n");
+		printf("%-16s %12s %10s %12s %10s %12s %8s %10s\n", "scenario", "search area", "search s", "ray area", "ray s", "rays", "noise", "difference");
+		for (i=0; i < NUM_SCENARIOS; i++)
+		{
+			rayResult *r = &rays[i];
+			rayRan[i] = runRayCheck(&scenarios[i], r);
+			if (!rayRan[i])
+			{
+				fprintf(stderr, "Error: ray shooting check of %s failed\n", scenarios[i].name);
+				ok = FALSE;
+				continue;
+			}
+			printf("%-16s %12.8f %10.4f %12.8f %10.4f %12ld %8.4f %+10.4f\n", scenarios[i].name, r->searchArea, r->searchSeconds,
+				r->rayArea, r->raySeconds, r->rays, r->noise, (r->searchArea - r->rayArea)/r->rayArea);
+			fflush(stdout);
+		}
+	}
+	
+	classifierResult classifiers[3];
+	int numClassifiers = 0;
+	if ((!anySelected || classifierSelected) && !runClassifierCheck(classifiers, &numClassifiers))
+	{
+		fprintf(stderr, "Error: classifier check failed\n");
+		ok = FALSE;
+	}
+	
+	if ((!anySelected || contourSelected) && !runContourCheck())
+	{
+		fprintf(stderr, "Error: outline check failed\n");
+		ok = FALSE;
+	}
+	
+	if (jsonFile != NULL && !writeBenchJSON(jsonFile, results, ran, rays, rayRan, classifiers, numClassifiers))
+		ok = FALSE;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,512 @@
+/*
+ * contour.c
+ * Image outlines by marching squares, with areas from Green's theorem.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "deflection.h"
+#include "searchstats.h"
+#include "contour.h"
+
+/*
+ * A cell at the search resolution that the image boundary may cross
+ */
+typedef struct boundaryCell {
+	int level;
+	uint64_t ix;
+	uint64_t iy;
+} boundaryCell;
+
+/*
+ * A corner of a boundary cell, and the slot (4*cell + corner) that receives
+ * the source indicator there
+ */
+typedef struct cellCorner {
+	uint64_t x;
+	uint64_t y;
+	int slot;
+} cellCorner;
+
+/*
+ * A piece of image boundary, with the image on its left
+ */
+typedef struct contourSegment {
+	point from;
+	point to;
+} contourSegment;
+
+typedef struct contourState {
+	boundaryCell *cells;
+	int numCells;
+	int maxCells;
+	double interiorArea;
+	boolean outOfMemory;
+} contourState;
+
+/*
+ * Prepares an empty set of outlines
+ */
+void initContourSet(contourSet *contours)
+{
+	memset(contours, 0, sizeof(contourSet));
+}
+
+/*
+ * Releases the outlines of a set
+ */
+void freeContourSet(contourSet *contours)
+{
+	free(contours->points);
+	free(contours->starts);
+	initContourSet(contours);
+}
+
+/*
+ * Adds a cell at the resolution to the cells to be contoured
+ */
+static void addBoundaryCell(contourState *state, searchGrid grid)
+{
+	if (state->numCells == state->maxCells)
+	{
+		int newMax = (state->maxCells > 0) ? 2*state->maxCells : 1024;
+		boundaryCell *cells = realloc(state->cells, newMax*sizeof(boundaryCell));
+		if (cells == NULL)
+		{
+			state->outOfMemory = TRUE;
+			return;
+		}
+		state->cells = cells;
+		state->maxCells = newMax;
+	}
+	state->cells[state->numCells].level = grid.level;
+	state->cells[state->numCells].ix = grid.ix;
+	state->cells[state->numCells].iy = grid.iy;
+	state->numCells++;
+}
+
+/*
+ * Classifies the grid as search() does, keeping the cells at the resolution
+ * that overlap the source (and those left on a critical curve) for
+ * contouring. Leaf cells are recorded in the context as usual
+ */
+static void collectBoundaryCells(searchGrid grid, contourState *state)
+{
+	boolean atResolution = gridAtResolution(grid);
+	int i;
+	countCell(grid, STAT_VISITED);
+	
+	if (grid.checkLenses)
+	{
+		if (containsLens(grid))
+		{
+			countCell(grid, STAT_LENS);
+			if (!atResolution)
+				for (i=0; i < 4; i++)
+					collectBoundaryCells(childGrid(grid, i), state);
+			return;
+		}
+		grid.checkLenses = FALSE;
+	}
+	
+	if (grid.checkCriticalCurve)
+	{
+		if (straddlesCriticalCurve(grid))
+		{
+			countCell(grid, STAT_CRITICAL_CURVE);
+			if (!atResolution)
+				for (i=0; i < 4; i++)
+					collectBoundaryCells(childGrid(grid, i), state);
+			else
+			{
+				addLeafCell(grid, OVERLAP);
+				addBoundaryCell(state, grid);
+			}
+			return;
+		}
+		grid.checkCriticalCurve = FALSE;
+	}
+	
+	intersectionType hit = mapsToSource(grid);
+	grid.context->calculations[grid.level] += 40;
+	
+	if (hit == NO_OVERLAP || hit == INSIDE_SOURCE || atResolution)
+	{
+		addLeafCell(grid, hit);
+		if (hit != NO_OVERLAP && atResolution)
+			addBoundaryCell(state, grid);
+		else if (hit == INSIDE_SOURCE)
+			state->interiorArea += grid.searchArea.size*grid.searchArea.size;
+		return;
+	}
+	
+	for (i=0; i < 4; i++)
+		collectBoundaryCells(childGrid(grid, i), state);
+}
+
+/*
+ * Orders corners by lattice position, so that shared corners are adjacent
+ */
+static int compareCellCorners(const void *a, const void *b)
+{
+	const cellCorner *p = a;
+	const cellCorner *q = b;
+	if (p->y != q->y)
+		return (p->y < q->y) ? -1 : 1;
+	if (p->x != q->x)
+		return (p->x < q->x) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Position of a corner of a boundary cell. It is found from the lattice, not
+ * from the cell's own area, so that every cell sharing the corner agrees on it
+ * exactly even when the root area is not dyadic
+ */
+static point latticeCorner(searchArea root, const boundaryCell *cell, corner c)
+{
+	double size = ldexp(root.size, 1 - cell->level);
+	uint64_t x = cell->ix + (c == TOP_RIGHT || c == BOTTOM_RIGHT);
+	uint64_t y = cell->iy + (c == TOP_LEFT || c == TOP_RIGHT);
+	return makePoint(root.x + x*size, root.y + y*size);
+}
+
+/*
+ * Evaluates the source indicator |beta - source|^2 - radius^2 (not positive
+ * inside the source) at the corners of every boundary cell, in corner order.
+ * Corners shared between cells are deflected once, so neighbouring cells see
+ * the same values. Returns FALSE if out of memory
+ */
+static boolean cornerIndicators(contourState *state, searchGrid root, double *values)
+{
+	int numCorners = 4*state->numCells;
+	cellCorner *corners = malloc(numCorners*sizeof(cellCorner));
+	point *image = malloc(numCorners*sizeof(point));
+	point *mapped = malloc(numCorners*sizeof(point));
+	if (corners == NULL || image == NULL || mapped == NULL)
+	{
+		free(corners);
+		free(image);
+		free(mapped);
+		return FALSE;
+	}
+	
+	int k, c;
+	for (k=0; k < state->numCells; k++)
+	{
+		for (c=0; c < 4; c++)
+		{
+			corners[4*k + c].x = state->cells[k].ix + (c == TOP_RIGHT || c == BOTTOM_RIGHT);
+			corners[4*k + c].y = state->cells[k].iy + (c == TOP_LEFT || c == TOP_RIGHT);
+			corners[4*k + c].slot = 4*k + c;
+		}
+	}
+	qsort(corners, numCorners, sizeof(cellCorner), compareCellCorners);
+	
+	int numUnique = 0;
+	for (k=0; k < numCorners; k++)
+	{
+		if (k > 0 && compareCellCorners(&corners[k], &corners[k - 1]) == 0)
+			continue;
+		image[numUnique++] = latticeCorner(root.searchArea, &state->cells[corners[k].slot/4], (corner)(corners[k].slot % 4));
+	}
+	deflectPoints(root.event, image, mapped, numUnique);
+	root.context->deflections += numUnique;
+	
+	source *s = root.source;
+	int n = -1;
+	for (k=0; k < numCorners; k++)
+	{
+		if (k == 0 || compareCellCorners(&corners[k], &corners[k - 1]) != 0)
+			n++;
+		double dx = mapped[n].x - s->origin.x;
+		double dy = mapped[n].y - s->origin.y;
+		values[corners[k].slot] = dx*dx + dy*dy - s->radius*s->radius;
+	}
+	
+	free(corners);
+	free(image);
+	free(mapped);
+	return TRUE;
+}
+
+/*
+ * Point where the indicator crosses zero on the edge between corners a and b.
+ * It is always interpolated from the bottom or left corner, so that the cells
+ * either side of an edge agree on it exactly
+ */
+static point edgeCrossing(point a, double fa, point b, double fb)
+{
+	if (b.x < a.x || b.y < a.y)
+		return edgeCrossing(b, fb, a, fa);
+	double t = fa/(fa - fb);
+	return makePoint(a.x + t*(b.x - a.x), a.y + t*(b.y - a.y));
+}
+
+/*
+ * Finds the part of a cell inside the source by marching squares. Walking
+ * anticlockwise round the cell, the corners inside the source and the zero
+ * crossings on its edges make a polygon, whose area is returned (by Green's
+ * theorem). Each stretch of the polygon from a crossing out of the source to
+ * the next crossing back in is image boundary, and is added to segments
+ */
+static double cellImageArea(searchArea root, const boundaryCell *cell, const double *f, contourSegment *segments, int *numSegments)
+{
+	static const corner walk[4] = {BOTTOM_LEFT, BOTTOM_RIGHT, TOP_RIGHT, TOP_LEFT};
+	point polygon[8];
+	int numVertices = 0;
+	int exitVertex = -1;
+	int firstEntry = -1;
+	int i;
+	
+	for (i=0; i < 4; i++)
+	{
+		corner a = walk[i];
+		corner b = walk[(i + 1) % 4];
+		boolean insideA = (f[a] <= 0);
+		boolean insideB = (f[b] <= 0);
+		point pa = latticeCorner(root, cell, a);
+		
+		if (insideA)
+			polygon[numVertices++] = pa;
+		if (insideA == insideB)
+			continue;
+		
+		polygon[numVertices] = edgeCrossing(pa, f[a], latticeCorner(root, cell, b), f[b]);
+		if (insideA)
+			exitVertex = numVertices;
+		else if (exitVertex >= 0)
+		{
+			segments[*numSegments].from = polygon[exitVertex];
+			segments[(*numSegments)++].to = polygon[numVertices];
+			exitVertex = -1;
+		}
+		else
+			firstEntry = numVertices;
+		numVertices++;
+	}
+	
+	// The last crossing out pairs with the first crossing in, round the corner of the walk
+	if (exitVertex >= 0 && firstEntry >= 0)
+	{
+		segments[*numSegments].from = polygon[exitVertex];
+		segments[(*numSegments)++].to = polygon[firstEntry];
+	}
+	
+	double area = 0;
+	for (i=0; i < numVertices; i++)
+	{
+		point p = polygon[i];
+		point q = polygon[(i + 1) % numVertices];
+		area += p.x*q.y - q.x*p.y;
+	}
+	return area/2;
+}
+
+/*
+ * Orders segments by their start point
+ */
+static int compareSegments(const void *a, const void *b)
+{
+	const contourSegment *p = a;
+	const contourSegment *q = b;
+	if (p->from.y != q->from.y)
+		return (p->from.y < q->from.y) ? -1 : 1;
+	if (p->from.x != q->from.x)
+		return (p->from.x < q->from.x) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Returns an unused segment starting at p, or -1 if there is none.
+ * Segments are sorted by start point
+ */
+static int findSegment(const contourSegment *segments, const boolean *used, int count, point p)
+{
+	contourSegment key;
+	key.from = p;
+	int low = 0, high = count;
+	while (low < high)
+	{
+		int mid = (low + high)/2;
+		if (compareSegments(&segments[mid], &key) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	for (; low < count && compareSegments(&segments[low], &key) == 0; low++)
+		if (!used[low])
+			return low;
+	return -1;
+}
+
+/*
+ * Adds a point to the outline being built. Returns FALSE if out of memory
+ */
+static boolean appendContourPoint(contourSet *contours, point p)
+{
+	if (contours->numPoints == contours->maxPoints)
+	{
+		int newMax = (contours->maxPoints > 0) ? 2*contours->maxPoints : 1024;
+		point *points = realloc(contours->points, newMax*sizeof(point));
+		if (points == NULL)
+			return FALSE;
+		contours->points = points;
+		contours->maxPoints = newMax;
+	}
+	contours->points[contours->numPoints++] = p;
+	return TRUE;
+}
+
+/*
+ * Starts a new outline at the next point. Returns FALSE if out of memory
+ */
+static boolean beginOutline(contourSet *contours)
+{
+	if (contours->numOutlines + 2 > contours->maxOutlines)
+	{
+		int newMax = (contours->maxOutlines > 0) ? 2*contours->maxOutlines : 64;
+		int *starts = realloc(contours->starts, newMax*sizeof(int));
+		if (starts == NULL)
+			return FALSE;
+		contours->starts = starts;
+		contours->maxOutlines = newMax;
+	}
+	contours->starts[contours->numOutlines++] = contours->numPoints;
+	contours->starts[contours->numOutlines] = contours->numPoints;
+	return TRUE;
+}
+
+/*
+ * Joins boundary segments end to end into outlines. Chains with a loose end
+ * (where an image leaves the search area, or meets a lens) are followed from
+ * that end; the rest close into loops. Returns FALSE if out of memory
+ */
+static boolean stitchOutlines(contourSegment *segments, int count, contourSet *contours)
+{
+	boolean *used = calloc(count, sizeof(boolean));
+	boolean *continued = calloc(count, sizeof(boolean));
+	if (count > 0 && (used == NULL || continued == NULL))
+	{
+		free(used);
+		free(continued);
+		return FALSE;
+	}
+	qsort(segments, count, sizeof(contourSegment), compareSegments);
+	
+	int i, pass;
+	for (i=0; i < count; i++)
+	{
+		int next = findSegment(segments, continued, count, segments[i].to);
+		if (next >= 0)
+			continued[next] = TRUE;
+	}
+	
+	boolean ok = TRUE;
+	for (pass=0; pass < 2 && ok; pass++)
+	{
+		for (i=0; i < count && ok; i++)
+		{
+			if (used[i] || (pass == 0 && continued[i]))
+				continue;
+			
+			ok = beginOutline(contours) && appendContourPoint(contours, segments[i].from);
+			int s = i;
+			while (ok && s >= 0)
+			{
+				used[s] = TRUE;
+				ok = appendContourPoint(contours, segments[s].to);
+				s = findSegment(segments, used, count, segments[s].to);
+			}
+			contours->starts[contours->numOutlines] = contours->numPoints;
+		}
+	}
+	
+	free(used);
+	free(continued);
+	return ok;
+}
+
+/*
+ * Finds the images of a source inside a given area, and returns their total
+ * area. The search is that of searchImages(), but cells at the resolution
+ * crossed by the image boundary count only the part of them inside it, found
+ * by marching squares on the source indicator at their corners. This removes
+ * most of the resolution bias of counting such cells whole. If contours is not
+ * NULL, it receives the image outlines, anticlockwise round the images.
+ */
+double searchImageContours(searchArea a, source *source, event *event, searchContext *context, contourSet *contours)
+{
+	contourState state;
+	memset(&state, 0, sizeof(contourState));
+	if (contours != NULL)
+	{
+		contours->numPoints = 0;
+		contours->numOutlines = 0;
+	}
+	
+	beginSearch(a, event, context);
+	searchGrid root = makeSearchGrid(a, source, event, context, TRUE, TRUE, 1);
+	collectBoundaryCells(root, &state);
+	
+	double *values = malloc(4*state.numCells*sizeof(double));
+	contourSegment *segments = malloc(2*state.numCells*sizeof(contourSegment));
+	if (state.outOfMemory || (state.numCells > 0 && (values == NULL || segments == NULL || !cornerIndicators(&state, root, values))))
+	{
+		// Fall back to counting the boundary cells whole
+		fprintf(stderr, "Error: out of memory contouring images\n");
+		free(values);
+		free(segments);
+		free(state.cells);
+		endSearch(context);
+		return context->imageArea;
+	}
+	
+	double area = state.interiorArea;
+	int numSegments = 0;
+	int k;
+	for (k=0; k < state.numCells; k++)
+		area += cellImageArea(a, &state.cells[k], &values[4*k], segments, &numSegments);
+	context->imageArea = area;
+	
+	if (contours != NULL && !stitchOutlines(segments, numSegments, contours))
+	{
+		fprintf(stderr, "Error: out of memory joining image outlines\n");
+		contours->numPoints = 0;
+		contours->numOutlines = 0;
+	}
+	
+	free(values);
+	free(segments);
+	free(state.cells);
+	endSearch(context);
+	return area;
+}
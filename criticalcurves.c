@@ -0,0 +1,419 @@
+/*
+ * criticalcurves.c
+ * Traces the critical curves of an event and maps them to caustics.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "typedefs.h"
+#include "deflection.h"
+#include "criticalcurves.h"
+
+// Cells per side of the grid searched for points on the curves
+#define MIN_SEED_CELLS 64
+#define MAX_SEED_CELLS 256
+
+// Largest turn of the curve in one step, in radians
+#define MAX_TURN 0.05
+
+#define MAX_NEWTON_STEPS 10
+#define JACOBIAN_TOLERANCE 1e-12
+#define BISECTION_STEPS 40
+
+// A curve that has not closed after this many points is left open
+#define MAX_CURVE_POINTS 100000
+
+/*
+ * Evaluates the jacobian determinant of the lens equation at p, and its
+ * gradient. With w = p - lens, the shear is G = sum m/conj(w)^2 and the
+ * determinant 1 - |G|^2, so the gradient follows from D = sum m/conj(w)^3
+ */
+static double jacobianAndGradient(event *e, point p, double *gx, double *gy)
+{
+	double dFxx = 1;
+	double dFyy = 1;
+	double dFxy = 0;
+	double dRe = 0;
+	double dIm = 0;
+	int j;
+	for (j=0; j < e->numLenses; j++)
+	{
+		lens l = e->lenses[j];
+		dFxx += lensJacobianContribution(l, p, 0);
+		dFxy += lensJacobianContribution(l, p, 1);
+		dFyy += lensJacobianContribution(l, p, 2);
+		
+		double dx = p.x - l.origin.x;
+		double dy = p.y - l.origin.y;
+		double dsq = dx*dx + dy*dy;
+		double f = l.mass/(dsq*dsq*dsq);
+		dRe += f*(dx*dx - 3*dy*dy)*dx;
+		dIm += f*(3*dx*dx - dy*dy)*dy;
+	}
+	
+	// Re and Im of conj(G) D
+	double g1 = dFxx - 1;
+	double g2 = dFxy;
+	*gx = 4*(g1*dRe + g2*dIm);
+	*gy = 4*(g1*dIm - g2*dRe);
+	return dFxx*dFyy - dFxy*dFxy;
+}
+
+/*
+ * Unit tangent to the curve of constant jacobian through p.
+ * Returns FALSE where the gradient vanishes
+ */
+static boolean curveTangent(event *e, point p, double *tx, double *ty)
+{
+	double gx, gy;
+	jacobianAndGradient(e, p, &gx, &gy);
+	double g = hypot(gx, gy);
+	if (!(g > 0))
+		return FALSE;
+	*tx = -gy/g;
+	*ty = gx/g;
+	return TRUE;
+}
+
+/*
+ * Moves p onto the nearest critical curve by Newton's method along the
+ * gradient. Returns FALSE if it does not converge
+ */
+static boolean projectOntoCurve(event *e, point *p)
+{
+	int i;
+	for (i=0; i < MAX_NEWTON_STEPS; i++)
+	{
+		double gx, gy;
+		double jacobian = jacobianAndGradient(e, *p, &gx, &gy);
+		if (fabs(jacobian) < JACOBIAN_TOLERANCE)
+			return TRUE;
+		
+		double gsq = gx*gx + gy*gy;
+		if (!(gsq > 0))
+			return FALSE;
+		p->x -= jacobian*gx/gsq;
+		p->y -= jacobian*gy/gsq;
+	}
+	return FALSE;
+}
+
+/*
+ * Finds a point on a critical curve between a and b, where the jacobian
+ * has signs ja and jb
+ */
+static point bisectCurve(event *e, point a, double ja, point b)
+{
+	int i;
+	for (i=0; i < BISECTION_STEPS; i++)
+	{
+		point m = makePoint((a.x + b.x)/2, (a.y + b.y)/2);
+		double gx, gy;
+		double jm = jacobianAndGradient(e, m, &gx, &gy);
+		if ((jm > 0) == (ja > 0))
+			a = m;
+		else
+			b = m;
+	}
+	return makePoint((a.x + b.x)/2, (a.y + b.y)/2);
+}
+
+/*
+ * Adds a point to the curve being traced. Returns FALSE if out of memory
+ */
+static boolean appendCurvePoint(criticalCurves *curves, point p)
+{
+	if (curves->numPoints == curves->maxPoints)
+	{
+		int newMax = (curves->maxPoints > 0) ? 2*curves->maxPoints : 1024;
+		point *critical = realloc(curves->critical, newMax*sizeof(point));
+		if (critical == NULL)
+			return FALSE;
+		curves->critical = critical;
+		curves->maxPoints = newMax;
+	}
+	curves->critical[curves->numPoints++] = p;
+	curves->starts[curves->numCurves] = curves->numPoints;
+	return TRUE;
+}
+
+/*
+ * Starts a new curve at the next point. Returns FALSE if out of memory
+ */
+static boolean beginCurve(criticalCurves *curves)
+{
+	if (curves->numCurves + 2 > curves->maxCurves)
+	{
+		int newMax = (curves->maxCurves > 0) ? 2*curves->maxCurves : 16;
+		int *starts = realloc(curves->starts, newMax*sizeof(int));
+		if (starts == NULL)
+			return FALSE;
+		curves->starts = starts;
+		curves->maxCurves = newMax;
+	}
+	curves->starts[curves->numCurves++] = curves->numPoints;
+	curves->starts[curves->numCurves] = curves->numPoints;
+	return TRUE;
+}
+
+/*
+ * Squared distance from p to the segment from a to b
+ */
+static double segmentDistanceSquared(point p, point a, point b)
+{
+	double dx = b.x - a.x;
+	double dy = b.y - a.y;
+	double lsq = dx*dx + dy*dy;
+	double t = (lsq > 0) ? ((p.x - a.x)*dx + (p.y - a.y)*dy)/lsq : 0;
+	t = fmin(fmax(t, 0), 1);
+	double ex = a.x + t*dx - p.x;
+	double ey = a.y + t*dy - p.y;
+	return ex*ex + ey*ey;
+}
+
+/*
+ * Returns TRUE if p lies within distance of a curve already traced
+ */
+static boolean nearTracedCurve(criticalCurves *curves, point p, double distance)
+{
+	int i, k;
+	for (i=0; i < curves->numCurves; i++)
+		for (k=curves->starts[i]; k + 1 < curves->starts[i + 1]; k++)
+			if (segmentDistanceSquared(p, curves->critical[k], curves->critical[k + 1]) < distance*distance)
+				return TRUE;
+	return FALSE;
+}
+
+/*
+ * Follows the critical curve through start until it closes. Each step goes
+ * along the tangent and back onto the curve by Newton's method. Steps are
+ * halved when the curve turns by more than MAX_TURN, or the step on either
+ * the critical curve or the caustic is longer than maxStep, and grow again
+ * on straighter stretches. Returns FALSE if out of memory
+ */
+static boolean traceCurve(event *e, point start, double maxStep, criticalCurves *curves)
+{
+	double step = maxStep/4;
+	double minStep = maxStep*1e-6;
+	double length = 0;
+	point p = start;
+	point pCaustic;
+	deflectPoints(e, &p, &pCaustic, 1);
+	
+	if (!beginCurve(curves) || !appendCurvePoint(curves, start))
+		return FALSE;
+	
+	int n;
+	for (n=1; n < MAX_CURVE_POINTS; n++)
+	{
+		double tx, ty;
+		if (!curveTangent(e, p, &tx, &ty))
+			return TRUE;
+		
+		point q, qCaustic;
+		double ux, uy;
+		for (;;)
+		{
+			q = makePoint(p.x + step*tx, p.y + step*ty);
+			if (projectOntoCurve(e, &q) && curveTangent(e, q, &ux, &uy) && tx*ux + ty*uy > cos(MAX_TURN))
+			{
+				deflectPoints(e, &q, &qCaustic, 1);
+				if (hypot(q.x - p.x, q.y - p.y) <= maxStep && hypot(qCaustic.x - pCaustic.x, qCaustic.y - pCaustic.y) <= maxStep)
+					break;
+			}
+			
+			// Leave the curve open if it cannot be followed
+			step /= 2;
+			if (step < minStep)
+				return TRUE;
+		}
+		
+		// The curve has closed once a step passes back over its start
+		double stepLength = hypot(q.x - p.x, q.y - p.y);
+		length += stepLength;
+		if (length > 3*stepLength && (start.x - p.x)*tx + (start.y - p.y)*ty > 0 &&
+			segmentDistanceSquared(start, p, q) < stepLength*stepLength/4)
+			return appendCurvePoint(curves, start);
+		
+		if (!appendCurvePoint(curves, q))
+			return FALSE;
+		if (tx*ux + ty*uy > cos(MAX_TURN/3))
+			step = fmin(1.5*step, maxStep);
+		p = q;
+		pCaustic = qCaustic;
+	}
+	return TRUE;
+}
+
+/*
+ * Traces the curve through a seed point, unless it has been traced already
+ */
+static boolean traceFromSeed(event *e, point seed, double maxStep, criticalCurves *curves)
+{
+	if (!projectOntoCurve(e, &seed) || nearTracedCurve(curves, seed, maxStep/20))
+		return TRUE;
+	return traceCurve(e, seed, maxStep, curves);
+}
+
+/*
+ * Finds the critical curves of an event, and their caustics. Points on the
+ * curves are found where the jacobian changes sign along the edges of a grid
+ * over the lenses, and outwards from each lens (inside the smallest curves).
+ * Each curve is then followed from the first such point on it.
+ * Returns NULL if out of memory
+ */
+criticalCurves *traceCriticalCurves(event *e)
+{
+	criticalCurves *curves = calloc(1, sizeof(criticalCurves));
+	if (curves == NULL || !beginCurve(curves))
+	{
+		fprintf(stderr, "Error: cannot allocate critical curves\n");
+		free(curves);
+		return NULL;
+	}
+	curves->numCurves = 0;
+	
+	if (e->numLenses == 0)
+		return curves;
+	
+	// The curves lie within a few Einstein radii of the lenses
+	double totalMass = 0;
+	double minMass = e->lenses[0].mass;
+	double minX = e->lenses[0].origin.x, maxX = minX;
+	double minY = e->lenses[0].origin.y, maxY = minY;
+	int i, j;
+	for (j=0; j < e->numLenses; j++)
+	{
+		lens l = e->lenses[j];
+		totalMass += l.mass;
+		minMass = fmin(minMass, l.mass);
+		minX = fmin(minX, l.origin.x);
+		maxX = fmax(maxX, l.origin.x);
+		minY = fmin(minY, l.origin.y);
+		maxY = fmax(maxY, l.origin.y);
+	}
+	double margin = 2*sqrt(totalMass);
+	double size = fmax(maxX - minX, maxY - minY) + 2*margin;
+	int cells = (int)ceil(size/(sqrt(minMass)/2));
+	cells = (cells < MIN_SEED_CELLS) ? MIN_SEED_CELLS : (cells > MAX_SEED_CELLS) ? MAX_SEED_CELLS : cells;
+	double spacing = size/cells;
+	double maxStep = spacing/2;
+	
+	boolean ok = TRUE;
+	
+	// Outwards from each lens, the jacobian goes from negative to positive
+	for (j=0; j < e->numLenses && ok; j++)
+	{
+		lens l = e->lenses[j];
+		double gx, gy;
+		double r = 1e-3*sqrt(l.mass);
+		point inner = makePoint(l.origin.x + r, l.origin.y);
+		double jInner = jacobianAndGradient(e, inner, &gx, &gy);
+		for (r *= 1.2; r < margin && ok; r *= 1.2)
+		{
+			point outer = makePoint(l.origin.x + r, l.origin.y);
+			double jOuter = jacobianAndGradient(e, outer, &gx, &gy);
+			if ((jInner > 0) != (jOuter > 0))
+			{
+				ok = traceFromSeed(e, bisectCurve(e, inner, jInner, outer), maxStep, curves);
+				break;
+			}
+			inner = outer;
+			jInner = jOuter;
+		}
+	}
+	
+	// Sign changes along the grid edges
+	double *row = malloc(2*(cells + 1)*sizeof(double));
+	point *points = malloc((cells + 1)*sizeof(point));
+	if (row == NULL || points == NULL)
+		ok = FALSE;
+	
+	double originX = (minX + maxX - size)/2;
+	double originY = (minY + maxY - size)/2;
+	for (j=0; j <= cells && ok; j++)
+	{
+		double *below = &row[((j + 1) % 2)*(cells + 1)];
+		double *current = &row[(j % 2)*(cells + 1)];
+		for (i=0; i <= cells; i++)
+			points[i] = makePoint(originX + i*spacing, originY + j*spacing);
+		lensJacobians(e, points, current, cells + 1);
+		
+		for (i=0; i <= cells && ok; i++)
+		{
+			if (i > 0 && (current[i] > 0) != (current[i - 1] > 0))
+				ok = traceFromSeed(e, bisectCurve(e, points[i - 1], current[i - 1], points[i]), maxStep, curves);
+			if (ok && j > 0 && (current[i] > 0) != (below[i] > 0))
+				ok = traceFromSeed(e, bisectCurve(e, makePoint(points[i].x, points[i].y - spacing), below[i], points[i]), maxStep, curves);
+		}
+	}
+	free(row);
+	free(points);
+	
+	if (ok && curves->numPoints > 0)
+	{
+		curves->caustic = malloc(curves->maxPoints*sizeof(point));
+		ok = (curves->caustic != NULL);
+		if (ok)
+			deflectPoints(e, curves->critical, curves->caustic, curves->numPoints);
+	}
+	
+	if (!ok)
+	{
+		fprintf(stderr, "Error: out of memory tracing critical curves\n");
+		freeCriticalCurves(curves);
+		return NULL;
+	}
+	return curves;
+}
+
+/*
+ * Releases a set of curves
+ */
+void freeCriticalCurves(criticalCurves *curves)
+{
+	if (curves == NULL)
+		return;
+	free(curves->critical);
+	free(curves->caustic);
+	free(curves->starts);
+	free(curves);
+}
+
+/*
+ * Returns the critical curves of an event, tracing them the first time they
+ * are needed. They are kept until the lenses change (updateLensArrays()) or
+ * the event is freed. Returns NULL if they cannot be traced
+ */
+criticalCurves *eventCriticalCurves(event *e)
+{
+	if (e->criticalCurves == NULL)
+		e->criticalCurves = traceCriticalCurves(e);
+	return e->criticalCurves;
+}
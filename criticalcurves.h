@@ -0,0 +1,54 @@
+/*
+ * criticalcurves.h
+ * Traces the critical curves of an event and maps them to caustics.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef CRITICALCURVES_HEADER
+#define CRITICALCURVES_HEADER
+
+/*
+ * Critical curves (where the lens jacobian vanishes) and their caustics.
+ * Curve i runs from critical[starts[i]] up to critical[starts[i+1]], and
+ * caustic[k] is the image of critical[k] in the source plane. Closed curves
+ * repeat their first point at the end
+ */
+typedef struct criticalCurves {
+	point *critical;
+	point *caustic;
+	int numPoints;
+	int maxPoints;
+	int *starts;
+	int numCurves;
+	int maxCurves;
+} criticalCurves;
+
+// Function declarations
+criticalCurves *traceCriticalCurves(event *e);
+void freeCriticalCurves(criticalCurves *curves);
+criticalCurves *eventCriticalCurves(event *e);
+#endif
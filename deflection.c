@@ -0,0 +1,484 @@
+/*
+ * deflection.c
+ * Vectorized lens equation kernels.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "typedefs.h"
+#include "deflection.h"
+#include "lenstree.h"
+#include "criticalcurves.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+typedef void (*deflectFunction)(event *e, const point *in, point *out, int count);
+typedef void (*jacobianFunction)(event *e, const point *in, double *jacobian, int count);
+
+static deflectFunction deflectImpl = NULL;
+static jacobianFunction jacobianImpl = NULL;
+static deflectionKernel activeKernel = KERNEL_SCALAR;
+static pthread_once_t kernelOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * (Re)builds the lens tree if the event uses tree deflection
+ */
+static void rebuildLensTree(event *e)
+{
+	freeLensTree(e->lensTree);
+	e->lensTree = NULL;
+	
+	if (e->openingAngle > 0 && e->numLenses > 0)
+	{
+		e->lensTree = buildLensTree(e->lenses, e->numLenses, e->openingAngle);
+		if (e->lensTree == NULL)
+			fprintf(stderr, "Error: cannot build lens tree; using direct sum\n");
+	}
+}
+
+/*
+ * Selects tree deflection with the given opening angle for the event.
+ * An angle of 0 restores the exact direct sum. Returns FALSE if the tree
+ * could not be built, in which case the direct sum is used.
+ */
+boolean setOpeningAngle(event *e, double openingAngle)
+{
+	e->openingAngle = fmax(openingAngle, 0);
+	rebuildLensTree(e);
+	return e->openingAngle == 0 || e->lensTree != NULL;
+}
+
+/*
+ * (Re)builds the structure-of-arrays copy of the event lenses, and the lens tree
+ * if one is used, and drops any traced critical curves. Must be called after
+ * modifying e->lenses. Returns FALSE if
+ * allocation fails, in which case the scalar kernel is used for this event.
+ */
+boolean updateLensArrays(event *e)
+{
+	rebuildLensTree(e);
+	freeCriticalCurves(e->criticalCurves);
+	e->criticalCurves = NULL;
+	
+	free(e->lensX);
+	free(e->lensY);
+	free(e->lensMass);
+	e->lensX = e->lensY = e->lensMass = NULL;
+	
+	if (e->numLenses <= 0)
+		return TRUE;
+	
+	size_t bytes = e->numLenses*sizeof(double);
+	void *x, *y, *m;
+	if (posix_memalign(&x, 32, bytes) != 0)
+		x = NULL;
+	if (posix_memalign(&y, 32, bytes) != 0)
+		y = NULL;
+	if (posix_memalign(&m, 32, bytes) != 0)
+		m = NULL;
+	
+	if (x == NULL || y == NULL || m == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate lens arrays\n");
+		free(x);
+		free(y);
+		free(m);
+		return FALSE;
+	}
+	
+	e->lensX = x;
+	e->lensY = y;
+	e->lensMass = m;
+	
+	int i;
+	for (i=0; i < e->numLenses; i++)
+	{
+		e->lensX[i] = e->lenses[i].origin.x;
+		e->lensY[i] = e->lenses[i].origin.y;
+		e->lensMass[i] = e->lenses[i].mass;
+	}
+	return TRUE;
+}
+
+/*
+ * Releases the memory allocated by makeEvent()
+ */
+void freeEvent(event *e)
+{
+	free(e->lensX);
+	free(e->lensY);
+	free(e->lensMass);
+	e->lensX = e->lensY = e->lensMass = NULL;
+	freeLensTree(e->lensTree);
+	e->lensTree = NULL;
+	freeCriticalCurves(e->criticalCurves);
+	e->criticalCurves = NULL;
+}
+
+/*
+ * Scalar lens equation: maps image plane points to the source plane
+ */
+static void deflectPointsScalar(event *e, const point *in, point *out, int count)
+{
+	int i,j;
+	for (i=0; i < count; i++)
+	{
+		double px = in[i].x;
+		double py = in[i].y;
+		double ux = px;
+		double uy = py;
+		for (j=0; j < e->numLenses; j++)
+		{
+			double dx = px - e->lenses[j].origin.x;
+			double dy = py - e->lenses[j].origin.y;
+			double f = e->lenses[j].mass/(dx*dx + dy*dy);
+			ux -= f*dx;
+			uy -= f*dy;
+		}
+		out[i].x = ux;
+		out[i].y = uy;
+	}
+}
+
+/*
+ * Scalar jacobian determinant of the lens equation
+ */
+static void lensJacobiansScalar(event *e, const point *in, double *jacobian, int count)
+{
+	int i,j;
+	for (i=0; i < count; i++)
+	{
+		double dFxx = 1;
+		double dFyy = 1;
+		double dFxy = 0;
+		for (j=0; j < e->numLenses; j++)
+		{
+			double dx = in[i].x - e->lenses[j].origin.x;
+			double dy = in[i].y - e->lenses[j].origin.y;
+			double dsq = dx*dx + dy*dy;
+			double f = e->lenses[j].mass/dsq;
+			double g = 2*f/dsq;
+			dFxx += g*dx*dx - f;
+			dFyy += g*dy*dy - f;
+			dFxy += g*dx*dy;
+		}
+		jacobian[i] = dFxx*dFyy - dFxy*dFxy;
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * SSE2 kernels: two points per iteration, one lens at a time
+ */
+__attribute__((target("sse2")))
+static void deflectPointsSSE2(event *e, const point *in, point *out, int count)
+{
+	int i,j;
+	for (i=0; i + 2 <= count; i += 2)
+	{
+		__m128d p0 = _mm_loadu_pd(&in[i].x);
+		__m128d p1 = _mm_loadu_pd(&in[i+1].x);
+		__m128d px = _mm_unpacklo_pd(p0, p1);
+		__m128d py = _mm_unpackhi_pd(p0, p1);
+		__m128d ux = px;
+		__m128d uy = py;
+		
+		for (j=0; j < e->numLenses; j++)
+		{
+			__m128d dx = _mm_sub_pd(px, _mm_set1_pd(e->lensX[j]));
+			__m128d dy = _mm_sub_pd(py, _mm_set1_pd(e->lensY[j]));
+			__m128d dsq = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+			__m128d f = _mm_div_pd(_mm_set1_pd(e->lensMass[j]), dsq);
+			ux = _mm_sub_pd(ux, _mm_mul_pd(f, dx));
+			uy = _mm_sub_pd(uy, _mm_mul_pd(f, dy));
+		}
+		_mm_storeu_pd(&out[i].x, _mm_unpacklo_pd(ux, uy));
+		_mm_storeu_pd(&out[i+1].x, _mm_unpackhi_pd(ux, uy));
+	}
+	deflectPointsScalar(e, in + i, out + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void lensJacobiansSSE2(event *e, const point *in, double *jacobian, int count)
+{
+	int i,j;
+	for (i=0; i + 2 <= count; i += 2)
+	{
+		__m128d p0 = _mm_loadu_pd(&in[i].x);
+		__m128d p1 = _mm_loadu_pd(&in[i+1].x);
+		__m128d px = _mm_unpacklo_pd(p0, p1);
+		__m128d py = _mm_unpackhi_pd(p0, p1);
+		__m128d dFxx = _mm_set1_pd(1);
+		__m128d dFyy = _mm_set1_pd(1);
+		__m128d dFxy = _mm_setzero_pd();
+		
+		for (j=0; j < e->numLenses; j++)
+		{
+			__m128d dx = _mm_sub_pd(px, _mm_set1_pd(e->lensX[j]));
+			__m128d dy = _mm_sub_pd(py, _mm_set1_pd(e->lensY[j]));
+			__m128d dsq = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+			__m128d f = _mm_div_pd(_mm_set1_pd(e->lensMass[j]), dsq);
+			__m128d g = _mm_div_pd(_mm_add_pd(f, f), dsq);
+			dFxx = _mm_add_pd(dFxx, _mm_sub_pd(_mm_mul_pd(_mm_mul_pd(g, dx), dx), f));
+			dFyy = _mm_add_pd(dFyy, _mm_sub_pd(_mm_mul_pd(_mm_mul_pd(g, dy), dy), f));
+			dFxy = _mm_add_pd(dFxy, _mm_mul_pd(_mm_mul_pd(g, dx), dy));
+		}
+		_mm_storeu_pd(&jacobian[i], _mm_sub_pd(_mm_mul_pd(dFxx, dFyy), _mm_mul_pd(dFxy, dFxy)));
+	}
+	lensJacobiansScalar(e, in + i, jacobian + i, count - i);
+}
+
+/*
+ * AVX2 kernels: four points per iteration, one lens at a time
+ */
+__attribute__((target("avx2")))
+static void deflectPointsAVX2(event *e, const point *in, point *out, int count)
+{
+	int i,j;
+	for (i=0; i + 4 <= count; i += 4)
+	{
+		// Deinterleave; the lane order (0,2,1,3) is undone by the matching store
+		__m256d p01 = _mm256_loadu_pd(&in[i].x);
+		__m256d p23 = _mm256_loadu_pd(&in[i+2].x);
+		__m256d px = _mm256_unpacklo_pd(p01, p23);
+		__m256d py = _mm256_unpackhi_pd(p01, p23);
+		__m256d ux = px;
+		__m256d uy = py;
+		
+		for (j=0; j < e->numLenses; j++)
+		{
+			__m256d dx = _mm256_sub_pd(px, _mm256_broadcast_sd(&e->lensX[j]));
+			__m256d dy = _mm256_sub_pd(py, _mm256_broadcast_sd(&e->lensY[j]));
+			__m256d dsq = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+			__m256d f = _mm256_div_pd(_mm256_broadcast_sd(&e->lensMass[j]), dsq);
+			ux = _mm256_sub_pd(ux, _mm256_mul_pd(f, dx));
+			uy = _mm256_sub_pd(uy, _mm256_mul_pd(f, dy));
+		}
+		_mm256_storeu_pd(&out[i].x, _mm256_unpacklo_pd(ux, uy));
+		_mm256_storeu_pd(&out[i+2].x, _mm256_unpackhi_pd(ux, uy));
+	}
+	deflectPointsScalar(e, in + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void lensJacobiansAVX2(event *e, const point *in, double *jacobian, int count)
+{
+	int i,j;
+	for (i=0; i + 4 <= count; i += 4)
+	{
+		__m256d p01 = _mm256_loadu_pd(&in[i].x);
+		__m256d p23 = _mm256_loadu_pd(&in[i+2].x);
+		__m256d px = _mm256_unpacklo_pd(p01, p23);
+		__m256d py = _mm256_unpackhi_pd(p01, p23);
+		__m256d dFxx = _mm256_set1_pd(1);
+		__m256d dFyy = _mm256_set1_pd(1);
+		__m256d dFxy = _mm256_setzero_pd();
+		
+		for (j=0; j < e->numLenses; j++)
+		{
+			__m256d dx = _mm256_sub_pd(px, _mm256_broadcast_sd(&e->lensX[j]));
+			__m256d dy = _mm256_sub_pd(py, _mm256_broadcast_sd(&e->lensY[j]));
+			__m256d dsq = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+			__m256d f = _mm256_div_pd(_mm256_broadcast_sd(&e->lensMass[j]), dsq);
+			__m256d g = _mm256_div_pd(_mm256_add_pd(f, f), dsq);
+			dFxx = _mm256_add_pd(dFxx, _mm256_sub_pd(_mm256_mul_pd(_mm256_mul_pd(g, dx), dx), f));
+			dFyy = _mm256_add_pd(dFyy, _mm256_sub_pd(_mm256_mul_pd(_mm256_mul_pd(g, dy), dy), f));
+			dFxy = _mm256_add_pd(dFxy, _mm256_mul_pd(_mm256_mul_pd(g, dx), dy));
+		}
+		
+		// Lanes hold points (0,2,1,3): swap the middle pair back before storing
+		__m256d det = _mm256_sub_pd(_mm256_mul_pd(dFxx, dFyy), _mm256_mul_pd(dFxy, dFxy));
+		_mm256_storeu_pd(&jacobian[i], _mm256_permute4x64_pd(det, _MM_SHUFFLE(3,1,2,0)));
+	}
+	lensJacobiansScalar(e, in + i, jacobian + i, count - i);
+}
+#endif
+
+/*
+ * Installs the requested kernel, falling back to the best supported one
+ */
+static void selectKernel(deflectionKernel kernel)
+{
+	deflectImpl = deflectPointsScalar;
+	jacobianImpl = lensJacobiansScalar;
+	activeKernel = KERNEL_SCALAR;
+	
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if ((kernel == KERNEL_AUTO || kernel == KERNEL_AVX2) && __builtin_cpu_supports("avx2"))
+	{
+		deflectImpl = deflectPointsAVX2;
+		jacobianImpl = lensJacobiansAVX2;
+		activeKernel = KERNEL_AVX2;
+	}
+	else if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("sse2"))
+	{
+		deflectImpl = deflectPointsSSE2;
+		jacobianImpl = lensJacobiansSSE2;
+		activeKernel = KERNEL_SSE2;
+	}
+#endif
+}
+
+/*
+ * Picks the kernel on first use.
+ * The RAYTRACE_KERNEL environment variable (scalar, sse2, avx2) overrides the choice
+ */
+static void selectDefaultKernel(void)
+{
+	const char *name = getenv("RAYTRACE_KERNEL");
+	deflectionKernel kernel = KERNEL_AUTO;
+	if (name != NULL)
+	{
+		if (strcmp(name, "scalar") == 0)
+			kernel = KERNEL_SCALAR;
+		else if (strcmp(name, "sse2") == 0)
+			kernel = KERNEL_SSE2;
+		else if (strcmp(name, "avx2") == 0)
+			kernel = KERNEL_AVX2;
+	}
+	selectKernel(kernel);
+}
+
+/*
+ * Forces a particular kernel (for benchmarking). Returns the kernel actually in use.
+ * Not thread safe: call before starting any searches
+ */
+deflectionKernel setDeflectionKernel(deflectionKernel kernel)
+{
+	pthread_once(&kernelOnce, selectDefaultKernel);
+	selectKernel(kernel);
+	return activeKernel;
+}
+
+/*
+ * Returns the name of the kernel in use
+ */
+const char *deflectionKernelName(void)
+{
+	pthread_once(&kernelOnce, selectDefaultKernel);
+	switch (activeKernel)
+	{
+		case KERNEL_AVX2:
+			return "avx2";
+		case KERNEL_SSE2:
+			return "sse2";
+		default:
+			return "scalar";
+	}
+}
+
+/*
+ * Maps count image plane points to the source plane through the lens equation
+ */
+void deflectPoints(event *e, const point *in, point *out, int count)
+{
+	pthread_once(&kernelOnce, selectDefaultKernel);
+	if (e->lensTree != NULL)
+		lensTreeDeflect(e->lensTree, in, out, count);
+	else if (e->lensX == NULL)
+		deflectPointsScalar(e, in, out, count);
+	else
+		deflectImpl(e, in, out, count);
+}
+
+/*
+ * Evaluates the jacobian determinant of the lens equation at count points
+ */
+void lensJacobians(event *e, const point *in, double *jacobian, int count)
+{
+	pthread_once(&kernelOnce, selectDefaultKernel);
+	if (e->lensTree != NULL)
+		lensTreeJacobians(e->lensTree, in, jacobian, count);
+	else if (e->lensX == NULL)
+		lensJacobiansScalar(e, in, jacobian, count);
+	else
+		jacobianImpl(e, in, jacobian, count);
+}
+
+/*
+ * Returns an upper bound on sum m_i/d_i^3, where d_i is the distance from lens i
+ * to the rectangle (or segment) with opposite corners a and b. Along any segment
+ * inside it the second derivative of the lens equation is at most twice this.
+ * The larger of the x and y gaps stands in for each distance, which avoids a
+ * square root; the sum stops early once it exceeds limit
+ */
+double lensCurvatureBound(event *e, point a, point b, double limit)
+{
+	double minX = fmin(a.x, b.x), maxX = fmax(a.x, b.x);
+	double minY = fmin(a.y, b.y), maxY = fmax(a.y, b.y);
+	
+	if (e->lensTree != NULL)
+		return lensTreeInverseDistanceSum(e->lensTree, minX, minY, maxX, maxY, 3);
+	
+	double bound = 0;
+	int i;
+	for (i=0; i < e->numLenses; i++)
+	{
+		double x = e->lenses[i].origin.x;
+		double y = e->lenses[i].origin.y;
+		double dx = (x < minX) ? minX - x : (x > maxX) ? x - maxX : 0;
+		double dy = (y < minY) ? minY - y : (y > maxY) ? y - maxY : 0;
+		double d = (dx > dy) ? dx : dy;
+		bound += e->lenses[i].mass/(d*d*d);
+		if (bound > limit)
+			break;
+	}
+	return bound;
+}
+
+/*
+ * Returns an upper bound on sum m_i/d_i^2, where d_i is the distance from lens i
+ * to the rectangle with opposite corners a and b. Between any two points inside
+ * it the deflection changes by at most this times their separation
+ */
+double deflectionLipschitzBound(event *e, point a, point b)
+{
+	double minX = fmin(a.x, b.x), maxX = fmax(a.x, b.x);
+	double minY = fmin(a.y, b.y), maxY = fmax(a.y, b.y);
+	
+	if (e->lensTree != NULL)
+		return lensTreeInverseDistanceSum(e->lensTree, minX, minY, maxX, maxY, 2);
+	
+	double bound = 0;
+	int i;
+	for (i=0; i < e->numLenses; i++)
+	{
+		double x = e->lenses[i].origin.x;
+		double y = e->lenses[i].origin.y;
+		double dx = (x < minX) ? minX - x : (x > maxX) ? x - maxX : 0;
+		double dy = (y < minY) ? minY - y : (y > maxY) ? y - maxY : 0;
+		bound += e->lenses[i].mass/(dx*dx + dy*dy);
+	}
+	return bound;
+}
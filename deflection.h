@@ -0,0 +1,50 @@
+/*
+ * deflection.h
+ * Vectorized lens equation kernels.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DEFLECTION_HEADER
+#define DEFLECTION_HEADER
+
+typedef enum deflectionKernel {
+	KERNEL_AUTO = 0,
+	KERNEL_SCALAR = 1,
+	KERNEL_SSE2 = 2,
+	KERNEL_AVX2 = 3
+} deflectionKernel;
+
+// Function declarations
+boolean updateLensArrays(event *e);
+boolean setOpeningAngle(event *e, double openingAngle);
+void freeEvent(event *e);
+void deflectPoints(event *e, const point *in, point *out, int count);
+void lensJacobians(event *e, const point *in, double *jacobian, int count);
+double lensCurvatureBound(event *e, point a, point b, double limit);
+double deflectionLipschitzBound(event *e, point a, point b);
+deflectionKernel setDeflectionKernel(deflectionKernel kernel);
+const char *deflectionKernelName(void);
+#endif
@@ -0,0 +1,150 @@
+/*
+ * displaylist.c
+ * Cached, view culled polylines for drawing curves.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "typedefs.h"
+#include "displaylist.h"
+
+// Most points in a chunk, including the one shared with the next
+#define CHUNK_POINTS 64
+
+/*
+ * Builds a display list from polylines: line i runs from points[starts[i]]
+ * up to points[starts[i+1]]. Points closer than tolerance to the last point
+ * kept are dropped, except the ends of each line, so the size of the list
+ * depends on the drawing resolution rather than on how finely the lines
+ * were sampled. Returns FALSE if there is no memory.
+ */
+boolean makeDisplayList(const point *points, const int *starts, int numLines, double tolerance, displayList *list)
+{
+	memset(list, 0, sizeof(displayList));
+	int numPoints = (numLines > 0) ? starts[numLines] - starts[0] : 0;
+	
+	// Each chunk holds at least CHUNK_POINTS - 1 new points, except the last of each line
+	int maxChunks = numPoints/(CHUNK_POINTS - 1) + numLines;
+	list->x = malloc(numPoints*sizeof(float));
+	list->y = malloc(numPoints*sizeof(float));
+	list->chunks = malloc(maxChunks*sizeof(displayChunk));
+	if (numPoints > 0 && (list->x == NULL || list->y == NULL || list->chunks == NULL))
+	{
+		fprintf(stderr, "Error: cannot allocate display list\n");
+		freeDisplayList(list);
+		return FALSE;
+	}
+	
+	double tolerance2 = tolerance*tolerance;
+	int i, k;
+	for (i=0; i < numLines; i++)
+	{
+		int first = list->numPoints;
+		for (k=starts[i]; k < starts[i + 1]; k++)
+		{
+			boolean end = (k == starts[i] || k == starts[i + 1] - 1);
+			if (!end)
+			{
+				double dx = points[k].x - list->x[list->numPoints - 1];
+				double dy = points[k].y - list->y[list->numPoints - 1];
+				if (dx*dx + dy*dy < tolerance2)
+					continue;
+			}
+			list->x[list->numPoints] = (float)points[k].x;
+			list->y[list->numPoints] = (float)points[k].y;
+			list->numPoints++;
+		}
+		
+		// Cut the line into chunks sharing their end points
+		int last = list->numPoints - 1;
+		int start = first;
+		if (last < first)
+			continue;
+		do
+		{
+			int count = last - start + 1;
+			if (count > CHUNK_POINTS)
+				count = CHUNK_POINTS;
+			
+			displayChunk *c = &list->chunks[list->numChunks++];
+			c->start = start;
+			c->count = count;
+			c->minX = c->maxX = list->x[start];
+			c->minY = c->maxY = list->y[start];
+			for (k=start + 1; k < start + count; k++)
+			{
+				c->minX = (list->x[k] < c->minX) ? list->x[k] : c->minX;
+				c->maxX = (list->x[k] > c->maxX) ? list->x[k] : c->maxX;
+				c->minY = (list->y[k] < c->minY) ? list->y[k] : c->minY;
+				c->maxY = (list->y[k] > c->maxY) ? list->y[k] : c->maxY;
+			}
+			start += count - 1;
+		} while (start < last);
+	}
+	return TRUE;
+}
+
+/*
+ * Releases the memory of a display list
+ */
+void freeDisplayList(displayList *list)
+{
+	free(list->x);
+	free(list->y);
+	free(list->chunks);
+	memset(list, 0, sizeof(displayList));
+}
+
+/*
+ * Finds the parts of the list to draw in a view. Chunks whose bounding box
+ * misses the view are skipped, and consecutive chunks of a line are joined.
+ * Each run of points runStarts[i], runCounts[i] is to be drawn as one
+ * polyline. The arrays need room for numChunks runs; returns the number of runs.
+ */
+int visibleRuns(const displayList *list, float minX, float maxX, float minY, float maxY, int *runStarts, int *runCounts)
+{
+	int numRuns = 0;
+	int k;
+	for (k=0; k < list->numChunks; k++)
+	{
+		const displayChunk *c = &list->chunks[k];
+		if (c->maxX < minX || c->minX > maxX || c->maxY < minY || c->minY > maxY)
+			continue;
+		
+		// A chunk continuing the previous run starts at its last point
+		if (numRuns > 0 && runStarts[numRuns - 1] + runCounts[numRuns - 1] - 1 == c->start)
+			runCounts[numRuns - 1] += c->count - 1;
+		else
+		{
+			runStarts[numRuns] = c->start;
+			runCounts[numRuns] = c->count;
+			numRuns++;
+		}
+	}
+	return numRuns;
+}
@@ -0,0 +1,62 @@
+/*
+ * displaylist.h
+ * Cached, view culled polylines for drawing curves.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+#ifndef DISPLAYLIST_HEADER
+#define DISPLAYLIST_HEADER
+
+/*
+ * A run of consecutive points of one polyline, with its bounding box.
+ * Consecutive chunks of a polyline share their end point
+ */
+typedef struct displayChunk {
+	int start;
+	int count;
+	float minX, maxX;
+	float minY, maxY;
+} displayChunk;
+
+/*
+ * Polylines thinned to the drawing resolution and cut into chunks, ready to
+ * be passed to the plotting library as float arrays
+ */
+typedef struct displayList {
+	float *x;
+	float *y;
+	int numPoints;
+	displayChunk *chunks;
+	int numChunks;
+} displayList;
+
+// Function declarations
+boolean makeDisplayList(const point *points, const int *starts, int numLines, double tolerance, displayList *list);
+void freeDisplayList(displayList *list);
+int visibleRuns(const displayList *list, float minX, float maxX, float minY, float maxY, int *runStarts, int *runCounts);
+#endif
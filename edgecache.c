@@ -0,0 +1,163 @@
+/*
+ * edgecache.c
+ * Cache of cell edges already mapped into the source plane.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "typedefs.h"
+#include "edgecache.h"
+
+#define TABLE_SIZE 8192
+#define RING_SIZE 32768
+
+// Longest edge that is cached. Edges found by a lookup stay valid while
+// another four of these are inserted, i.e. for the rest of mapBoundary()
+#define MAX_CACHED_SAMPLES (RING_SIZE/16)
+
+/*
+ * Creates an empty cache. Returns NULL if it cannot be allocated
+ */
+edgeCache *newEdgeCache(void)
+{
+	edgeCache *cache = malloc(sizeof(edgeCache));
+	if (cache == NULL)
+		return NULL;
+	
+	cache->entries = malloc(TABLE_SIZE*sizeof(edgeEntry));
+	cache->ring = malloc(RING_SIZE*sizeof(point));
+	cache->offsets = malloc(RING_SIZE*sizeof(uint32_t));
+	if (cache->entries == NULL || cache->ring == NULL || cache->offsets == NULL)
+	{
+		free(cache->entries);
+		free(cache->ring);
+		free(cache->offsets);
+		free(cache);
+		return NULL;
+	}
+	resetEdgeCache(cache);
+	return cache;
+}
+
+/*
+ * Releases a cache
+ */
+void freeEdgeCache(edgeCache *cache)
+{
+	if (cache == NULL)
+		return;
+	free(cache->entries);
+	free(cache->ring);
+	free(cache->offsets);
+	free(cache);
+}
+
+/*
+ * Empties the cache
+ */
+void resetEdgeCache(edgeCache *cache)
+{
+	int k;
+	for (k=0; k < TABLE_SIZE; k++)
+		cache->entries[k].level = 0;
+	
+	// Leave a full ring of space so that no stale position looks valid
+	cache->head = RING_SIZE;
+}
+
+/*
+ * The table slot for an edge
+ */
+static edgeEntry *edgeSlot(edgeCache *cache, int level, edgeDirection direction, uint64_t i, uint64_t j)
+{
+	uint64_t h = (i*0x9E3779B97F4A7C15ULL + j)*0xFF51AFD7ED558CCDULL + (uint64_t)(2*level + direction);
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return &cache->entries[h & (TABLE_SIZE - 1)];
+}
+
+/*
+ * Finds the mapped samples of an edge and their offsets along it (NULL if
+ * uniform), or NULL if it is not in the cache
+ */
+point *lookupEdge(edgeCache *cache, int level, edgeDirection direction, uint64_t i, uint64_t j, uint32_t **offsets, int *numSamples)
+{
+	edgeEntry *e = edgeSlot(cache, level, direction, i, j);
+	if (e->level != level || e->direction != direction || e->i != i || e->j != j)
+		return NULL;
+	
+	// The samples may have been (or be about to be) overwritten since
+	if (cache->head - e->position > RING_SIZE/2)
+		return NULL;
+	
+	*offsets = e->uniform ? NULL : cache->offsets + e->position % RING_SIZE;
+	*numSamples = e->numSamples;
+	return cache->ring + e->position % RING_SIZE;
+}
+
+/*
+ * Adds an edge to the cache, replacing any edge in the same slot, and returns
+ * storage for its numSamples samples, which the caller must fill. Storage for
+ * their offsets is returned through offsets, or the samples are taken to be
+ * uniform if offsets is NULL. Returns NULL if the edge is too long to cache.
+ */
+point *insertEdge(edgeCache *cache, int level, edgeDirection direction, uint64_t i, uint64_t j, int numSamples, uint32_t **offsets)
+{
+	if (numSamples > MAX_CACHED_SAMPLES)
+		return NULL;
+	
+	// Samples are stored contiguously, so skip to the start of the ring if they would wrap
+	uint64_t offset = cache->head % RING_SIZE;
+	if (offset + numSamples > RING_SIZE)
+		cache->head += RING_SIZE - offset;
+	
+	edgeEntry *e = edgeSlot(cache, level, direction, i, j);
+	e->i = i;
+	e->j = j;
+	e->level = level;
+	e->direction = direction;
+	e->numSamples = numSamples;
+	e->uniform = (offsets == NULL);
+	e->position = cache->head;
+	cache->head += numSamples;
+	
+	if (offsets != NULL)
+		*offsets = cache->offsets + e->position % RING_SIZE;
+	return cache->ring + e->position % RING_SIZE;
+}
+
+/*
+ * Removes an edge from the cache, if it is there, so that samples that were
+ * never filled in are not used
+ */
+void removeEdge(edgeCache *cache, int level, edgeDirection direction, uint64_t i, uint64_t j)
+{
+	edgeEntry *e = edgeSlot(cache, level, direction, i, j);
+	if (e->level == level && e->direction == direction && e->i == i && e->j == j)
+		e->level = 0;
+}
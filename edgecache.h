@@ -0,0 +1,79 @@
+/*
+ * edgecache.h
+ * Cache of cell edges already mapped into the source plane.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef EDGECACHE_HEADER
+#define EDGECACHE_HEADER
+
+#include <stdint.h>
+
+typedef enum edgeDirection {
+	HORIZONTAL_EDGE = 0,
+	VERTICAL_EDGE = 1
+} edgeDirection;
+
+// Sample positions along an edge are multiples of 2^-EDGE_DEPTH of its length
+#define EDGE_DEPTH 24
+
+/*
+ * A cell edge on the dyadic lattice of its level: the horizontal edge (i,j)
+ * runs from lattice point (i,j) to (i+1,j), the vertical edge to (i,j+1).
+ * Its numSamples samples (including both ends) start at position in the sample ring,
+ * and their offsets along the edge are kept alongside unless they are uniform.
+ */
+typedef struct edgeEntry {
+	uint64_t i;
+	uint64_t j;
+	int level;
+	edgeDirection direction;
+	int numSamples;
+	boolean uniform;
+	uint64_t position;
+} edgeEntry;
+
+/*
+ * A small, lossy cache: a direct mapped table of edges whose samples are kept
+ * in a ring buffer. Neighbouring cells are visited close together in the
+ * depth-first search, so most reuse happens long before an edge is evicted,
+ * and the whole cache stays resident in the processor cache.
+ */
+typedef struct edgeCache {
+	edgeEntry *entries;
+	point *ring;
+	uint32_t *offsets;
+	uint64_t head;
+} edgeCache;
+
+// Function declarations
+edgeCache *newEdgeCache(void);
+void freeEdgeCache(edgeCache *cache);
+void resetEdgeCache(edgeCache *cache);
+point *lookupEdge(edgeCache *cache, int level, edgeDirection direction, uint64_t i, uint64_t j, uint32_t **offsets, int *numSamples);
+point *insertEdge(edgeCache *cache, int level, edgeDirection direction, uint64_t i, uint64_t j, int numSamples, uint32_t **offsets);
+void removeEdge(edgeCache *cache, int level, edgeDirection direction, uint64_t i, uint64_t j);
+#endif
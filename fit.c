@@ -0,0 +1,196 @@
+/*
+ * fit.c
+ * Fits microlensing lightcurve parameters to observed photometry.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "typedefs.h"
+#include "deflection.h"
+#include "fitting.h"
+
+#define MAX_FIT_LENSES 100
+#define DEFAULT_ANNULI 10
+
+/*
+ * Reads a parameter range ("name min max steps") or a fixed value ("name value")
+ */
+static boolean parseRange(const char *line, parameterRange *range)
+{
+	char name[64];
+	int n = sscanf(line, "%63s %lf %lf %d", name, &range->min, &range->max, &range->steps);
+	if (n == 2)
+	{
+		range->max = range->min;
+		range->steps = 1;
+		return TRUE;
+	}
+	return (n == 4 && range->steps > 0);
+}
+
+/*
+ * Reads the fit settings. Each line is a keyword and its values:
+ *   lens x y mass            (once per lens)
+ *   window x y size          (image plane search area)
+ *   resolution r
+ *   openingAngle theta       (optional lens tree, see README)
+ *   limbCoefficient u
+ *   annuli n
+ *   peakTime, crossingTime, impactRadius, sourceRadius: min max steps, or a value
+ * Returns FALSE if the file cannot be read or is incomplete
+ */
+static boolean readSettings(const char *filename, lens *lenses, int *numLenses, searchArea *window, double *resolution, double *openingAngle,
+	double *limbCoefficient, int *numAnnuli, fitGrid *grid)
+{
+	FILE *in = fopen(filename, "r");
+	if (in == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	memset(grid, 0, sizeof(fitGrid));
+	*numLenses = 0;
+	*resolution = 0;
+	*window = makeSearchArea(0, 0, 0);
+	
+	char line[256];
+	int lineNumber = 0;
+	boolean ok = TRUE;
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		lineNumber++;
+		char key[64];
+		double x, y, z;
+		if (sscanf(line, "%63s", key) != 1 || key[0] == '#')
+			continue;
+		
+		boolean valid;
+		if (strcmp(key, "lens") == 0)
+		{
+			valid = (sscanf(line, "%*s %lf %lf %lf", &x, &y, &z) == 3 && *numLenses < MAX_FIT_LENSES);
+			if (valid)
+				lenses[(*numLenses)++] = makeLens(makePoint(x, y), z);
+		}
+		else if (strcmp(key, "window") == 0)
+		{
+			valid = (sscanf(line, "%*s %lf %lf %lf", &x, &y, &z) == 3);
+			*window = makeSearchArea(x, y, z);
+		}
+		else if (strcmp(key, "resolution") == 0)
+			valid = (sscanf(line, "%*s %lf", resolution) == 1);
+		else if (strcmp(key, "openingAngle") == 0)
+			valid = (sscanf(line, "%*s %lf", openingAngle) == 1);
+		else if (strcmp(key, "limbCoefficient") == 0)
+			valid = (sscanf(line, "%*s %lf", limbCoefficient) == 1);
+		else if (strcmp(key, "annuli") == 0)
+			valid = (sscanf(line, "%*s %d", numAnnuli) == 1 && *numAnnuli > 0);
+		else if (strcmp(key, "peakTime") == 0)
+			valid = parseRange(line, &grid->peakTime);
+		else if (strcmp(key, "crossingTime") == 0)
+			valid = parseRange(line, &grid->crossingTime);
+		else if (strcmp(key, "impactRadius") == 0)
+			valid = parseRange(line, &grid->impactRadius);
+		else if (strcmp(key, "sourceRadius") == 0)
+			valid = parseRange(line, &grid->sourceRadius);
+		else
+			valid = FALSE;
+		
+		if (!valid)
+		{
+			fprintf(stderr, "Error: cannot parse line %d of %s\n", lineNumber, filename);
+			ok = FALSE;
+		}
+	}
+	fclose(in);
+	
+	if (ok && (*numLenses == 0 || *resolution <= 0 || window->size <= 0 || grid->peakTime.steps == 0 ||
+		grid->crossingTime.steps == 0 || grid->impactRadius.steps == 0 || grid->sourceRadius.steps == 0))
+	{
+		fprintf(stderr, "Error: %s needs lens, window, resolution, peakTime, crossingTime, impactRadius and sourceRadius\n", filename);
+		ok = FALSE;
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "Usage: %s settings photometry [threads]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	lens lenses[MAX_FIT_LENSES];
+	int numLenses;
+	searchArea window;
+	double resolution;
+	double openingAngle = 0;
+	double limbCoefficient = 0;
+	int numAnnuli = DEFAULT_ANNULI;
+	fitGrid grid;
+	if (!readSettings(argv[1], lenses, &numLenses, &window, &resolution, &openingAngle, &limbCoefficient, &numAnnuli, &grid))
+		return EXIT_FAILURE;
+	
+	photometry data;
+	if (!readPhotometry(argv[2], &data))
+		return EXIT_FAILURE;
+	
+	event e = makeEvent(numLenses, lenses, resolution);
+	if (openingAngle > 0)
+		setOpeningAngle(&e, openingAngle);
+	
+	// A uniform source needs only the one disk
+	if (limbCoefficient == 0)
+		numAnnuli = 1;
+	
+	int numThreads = (argc > 3) ? atoi(argv[3]) : 0;
+	int numModels = grid.peakTime.steps*grid.crossingTime.steps*grid.impactRadius.steps*grid.sourceRadius.steps;
+	printf("Fitting %d models to %d points\n", numModels, data.count);
+	
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fitModel best;
+	boolean found = fitLightcurveGrid(window, &e, &data, grid, limbCoefficient, numAnnuli, numThreads, &best);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	if (found)
+	{
+		printf("peakTime %f\ncrossingTime %f\nimpactRadius %f\nsourceRadius %f\n", best.peakTime, best.crossingTime, best.impactRadius, best.sourceRadius);
+		printf("sourceFlux %g\nblendFlux %g\nchiSquared %f (%d points)\n", best.sourceFlux, best.blendFlux, best.chiSquared, data.count);
+	}
+	else
+		fprintf(stderr, "Error: no model could be evaluated\n");
+	printf("Time %.2fs\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)*1e-9);
+	
+	freeEvent(&e);
+	freePhotometry(&data);
+	return found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,305 @@
+/*
+ * fitting.c
+ * Chi-squared fits of finite source lightcurves to observed photometry.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "parallelsearch.h"
+#include "lightcurve.h"
+#include "fitting.h"
+
+#define INITIAL_POINTS 256
+
+/*
+ * Reads photometry from a text file of "time flux error" lines.
+ * Blank lines and lines starting with # are skipped.
+ * Returns FALSE if the file cannot be read
+ */
+boolean readPhotometry(const char *filename, photometry *data)
+{
+	memset(data, 0, sizeof(photometry));
+	FILE *in = fopen(filename, "r");
+	if (in == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	char line[256];
+	int lineNumber = 0;
+	int capacity = 0;
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		lineNumber++;
+		double t, f, e;
+		char first = line[strspn(line, " \t")];
+		if (first == '#' || first == '\n' || first == '\0')
+			continue;
+		
+		if (sscanf(line, "%lf %lf %lf", &t, &f, &e) != 3 || !(e > 0))
+		{
+			fprintf(stderr, "Error: cannot parse line %d of %s\n", lineNumber, filename);
+			continue;
+		}
+		
+		if (data->count == capacity)
+		{
+			capacity = (capacity > 0) ? 2*capacity : INITIAL_POINTS;
+			double *times = realloc(data->times, capacity*sizeof(double));
+			if (times != NULL)
+				data->times = times;
+			double *fluxes = realloc(data->fluxes, capacity*sizeof(double));
+			if (fluxes != NULL)
+				data->fluxes = fluxes;
+			double *errors = realloc(data->errors, capacity*sizeof(double));
+			if (errors != NULL)
+				data->errors = errors;
+			
+			if (times == NULL || fluxes == NULL || errors == NULL)
+			{
+				fprintf(stderr, "Error: cannot allocate photometry of %d points\n", capacity);
+				fclose(in);
+				freePhotometry(data);
+				return FALSE;
+			}
+		}
+		data->times[data->count] = t;
+		data->fluxes[data->count] = f;
+		data->errors[data->count] = e;
+		data->count++;
+	}
+	fclose(in);
+	return TRUE;
+}
+
+/*
+ * Releases the arrays of a photometry set
+ */
+void freePhotometry(photometry *data)
+{
+	free(data->times);
+	free(data->fluxes);
+	free(data->errors);
+	memset(data, 0, sizeof(photometry));
+}
+
+/*
+ * Returns value i of a range of steps evenly spaced values
+ */
+double parameterValue(parameterRange range, int i)
+{
+	return (range.steps > 1) ? range.min + (range.max - range.min)*i/(range.steps - 1) : range.min;
+}
+
+/*
+ * Finds the source and blend fluxes that best fit a model lightcurve to the
+ * data (flux = sourceFlux*magnification + blendFlux), and returns chi squared
+ */
+double fitFluxes(photometry *data, const double *magnifications, double *sourceFlux, double *blendFlux)
+{
+	double s = 0, sa = 0, saa = 0, sf = 0, saf = 0;
+	int i;
+	for (i=0; i < data->count; i++)
+	{
+		double w = 1/(data->errors[i]*data->errors[i]);
+		double a = magnifications[i];
+		s += w;
+		sa += w*a;
+		saa += w*a*a;
+		sf += w*data->fluxes[i];
+		saf += w*a*data->fluxes[i];
+	}
+	
+	// A constant model leaves the source flux undetermined
+	double det = s*saa - sa*sa;
+	*sourceFlux = (det != 0) ? (s*saf - sa*sf)/det : 0;
+	*blendFlux = (det != 0) ? (saa*sf - sa*saf)/det : sf/s;
+	
+	double chiSquared = 0;
+	for (i=0; i < data->count; i++)
+	{
+		double r = (data->fluxes[i] - *sourceFlux*magnifications[i] - *blendFlux)/data->errors[i];
+		chiSquared += r*r;
+	}
+	return chiSquared;
+}
+
+/*
+ * Models sharing a trajectory differ only in source radius, so each task is
+ * one trajectory with all the radii of the grid
+ */
+typedef struct fitPool {
+	searchArea area;
+	event *event;
+	photometry *data;
+	fitGrid grid;
+	double limbCoefficient;
+	int numAnnuli;
+	int numTasks;
+	
+	pthread_mutex_t lock;
+	int nextTask;
+	fitModel *results;
+} fitPool;
+
+/*
+ * Takes the next trajectory to fit, or -1 if there are none left
+ */
+static int nextFitTask(fitPool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	int task = (pool->nextTask < pool->numTasks) ? pool->nextTask++ : -1;
+	pthread_mutex_unlock(&pool->lock);
+	return task;
+}
+
+/*
+ * Worker thread: fits trajectories until there are none left, keeping the
+ * best source radius of each. The search context, and with it the jacobian
+ * cache, is reused between the trajectories a thread fits
+ */
+static void *runFitWorker(void *arg)
+{
+	fitPool *pool = arg;
+	fitGrid *grid = &pool->grid;
+	int numTimes = pool->data->count;
+	int numRadii = grid->sourceRadius.steps;
+	double *radii = malloc(numRadii*sizeof(double));
+	double *magnifications = malloc(numRadii*numTimes*sizeof(double));
+	
+	searchContext context;
+	initSearchContext(&context, FALSE);
+	
+	int task, r;
+	while ((task = nextFitTask(pool)) >= 0)
+	{
+		int p = task % grid->peakTime.steps;
+		int c = (task/grid->peakTime.steps) % grid->crossingTime.steps;
+		int u = task/(grid->peakTime.steps*grid->crossingTime.steps);
+		
+		fitModel *best = &pool->results[task];
+		best->peakTime = parameterValue(grid->peakTime, p);
+		best->crossingTime = parameterValue(grid->crossingTime, c);
+		best->impactRadius = parameterValue(grid->impactRadius, u);
+		best->chiSquared = HUGE_VAL;
+		
+		for (r=0; r < numRadii && radii != NULL; r++)
+			radii[r] = parameterValue(grid->sourceRadius, r);
+		
+		trajectory path = makeTrajectory(best->peakTime, best->crossingTime, best->impactRadius);
+		if (radii == NULL || magnifications == NULL || !limbDarkenedLightcurves(pool->area, pool->event, &context, path, radii, numRadii,
+			pool->limbCoefficient, pool->numAnnuli, pool->data->times, numTimes, magnifications))
+			continue;
+		
+		for (r=0; r < numRadii; r++)
+		{
+			double sourceFlux, blendFlux;
+			double chiSquared = fitFluxes(pool->data, magnifications + r*numTimes, &sourceFlux, &blendFlux);
+			if (chiSquared < best->chiSquared)
+			{
+				best->sourceRadius = radii[r];
+				best->sourceFlux = sourceFlux;
+				best->blendFlux = blendFlux;
+				best->chiSquared = chiSquared;
+			}
+		}
+	}
+	
+	freeSearchContext(&context);
+	free(radii);
+	free(magnifications);
+	return NULL;
+}
+
+/*
+ * Fits limb darkened lightcurves to the data over every combination of the
+ * parameter values in grid, with the lenses of e held fixed, using numThreads
+ * threads (or one per processor if numThreads <= 0). Writes the model with the
+ * lowest chi squared to best. Returns FALSE if no model could be evaluated
+ */
+boolean fitLightcurveGrid(searchArea a, event *e, photometry *data, fitGrid grid, double limbCoefficient, int numAnnuli, int numThreads, fitModel *best)
+{
+	if (numThreads <= 0)
+		numThreads = defaultThreadCount();
+	if (grid.peakTime.steps < 1 || grid.crossingTime.steps < 1 || grid.impactRadius.steps < 1 || grid.sourceRadius.steps < 1 || data->count == 0)
+		return FALSE;
+	
+	fitPool pool;
+	pool.area = a;
+	pool.event = e;
+	pool.data = data;
+	pool.grid = grid;
+	pool.limbCoefficient = limbCoefficient;
+	pool.numAnnuli = numAnnuli;
+	pool.numTasks = grid.peakTime.steps*grid.crossingTime.steps*grid.impactRadius.steps;
+	pool.nextTask = 0;
+	pool.results = malloc(pool.numTasks*sizeof(fitModel));
+	pthread_t *threads = malloc(numThreads*sizeof(pthread_t));
+	if (pool.results == NULL || threads == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate fit of %d models\n", pool.numTasks);
+		free(pool.results);
+		free(threads);
+		return FALSE;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	
+	// The calling thread is one of the workers
+	int i, started = 0;
+	for (i=1; i < numThreads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, runFitWorker, &pool) != 0)
+			break;
+		started++;
+	}
+	runFitWorker(&pool);
+	for (i=1; i <= started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pool.lock);
+	
+	// Scan in grid order so that ties are settled the same way every run
+	boolean found = FALSE;
+	for (i=0; i < pool.numTasks; i++)
+	{
+		if (pool.results[i].chiSquared < HUGE_VAL && (!found || pool.results[i].chiSquared < best->chiSquared))
+		{
+			*best = pool.results[i];
+			found = TRUE;
+		}
+	}
+	
+	free(pool.results);
+	free(threads);
+	return found;
+}
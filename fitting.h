@@ -0,0 +1,73 @@
+/*
+ * fitting.h
+ * Chi-squared fits of finite source lightcurves to observed photometry.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef FITTING_HEADER
+#define FITTING_HEADER
+
+typedef struct photometry {
+	double *times;
+	double *fluxes;
+	double *errors;
+	int count;
+} photometry;
+
+typedef struct parameterRange {
+	double min;
+	double max;
+	int steps;
+} parameterRange;
+
+/*
+ * The values tried for each parameter of the source trajectory and size
+ */
+typedef struct fitGrid {
+	parameterRange peakTime;
+	parameterRange crossingTime;
+	parameterRange impactRadius;
+	parameterRange sourceRadius;
+} fitGrid;
+
+typedef struct fitModel {
+	double peakTime;
+	double crossingTime;
+	double impactRadius;
+	double sourceRadius;
+	double sourceFlux;
+	double blendFlux;
+	double chiSquared;
+} fitModel;
+
+// Function declarations
+boolean readPhotometry(const char *filename, photometry *data);
+void freePhotometry(photometry *data);
+double parameterValue(parameterRange range, int i);
+double fitFluxes(photometry *data, const double *magnifications, double *sourceFlux, double *blendFlux);
+boolean fitLightcurveGrid(searchArea a, event *e, photometry *data, fitGrid grid, double limbCoefficient, int numAnnuli, int numThreads, fitModel *best);
+#endif
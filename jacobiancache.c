@@ -0,0 +1,238 @@
+/*
+ * jacobiancache.c
+ * Lattice cache of the lens equation jacobian sign at cell corners.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "typedefs.h"
+#include "deflection.h"
+#include "jacobiancache.h"
+
+#define INITIAL_CAPACITY 4096
+
+// Start again rather than grow beyond this many corners
+#define MAX_ENTRIES (1 << 22)
+
+/*
+ * Creates an empty cache. Returns NULL if it cannot be allocated
+ */
+jacobianCache *newJacobianCache(void)
+{
+	jacobianCache *cache = malloc(sizeof(jacobianCache));
+	if (cache == NULL)
+		return NULL;
+	
+	cache->entries = calloc(INITIAL_CAPACITY, sizeof(jacobianEntry));
+	if (cache->entries == NULL)
+	{
+		free(cache);
+		return NULL;
+	}
+	cache->capacity = INITIAL_CAPACITY;
+	cache->count = 0;
+	cache->root = makeSearchArea(0, 0, 0);
+	cache->openingAngle = 0;
+	cache->numLenses = 0;
+	cache->lenses = NULL;
+	return cache;
+}
+
+/*
+ * Releases a cache
+ */
+void freeJacobianCache(jacobianCache *cache)
+{
+	if (cache == NULL)
+		return;
+	free(cache->entries);
+	free(cache->lenses);
+	free(cache);
+}
+
+/*
+ * Empties the cache
+ */
+static void clearJacobianCache(jacobianCache *cache)
+{
+	memset(cache->entries, 0, cache->capacity*sizeof(jacobianEntry));
+	cache->count = 0;
+}
+
+/*
+ * Empties the cache if the lenses, opening angle or root area differ from those it
+ * was filled with
+ */
+void validateJacobianCache(jacobianCache *cache, searchArea root, event *e)
+{
+	if (cache->numLenses == e->numLenses && cache->openingAngle == e->openingAngle &&
+		cache->root.x == root.x && cache->root.y == root.y && cache->root.size == root.size &&
+		(e->numLenses == 0 || memcmp(cache->lenses, e->lenses, e->numLenses*sizeof(lens)) == 0))
+		return;
+	
+	clearJacobianCache(cache);
+	free(cache->lenses);
+	cache->lenses = malloc(e->numLenses*sizeof(lens));
+	if (cache->lenses == NULL)
+	{
+		// Leave the cache marked as not matching anything
+		cache->numLenses = -1;
+		return;
+	}
+	memcpy(cache->lenses, e->lenses, e->numLenses*sizeof(lens));
+	cache->numLenses = e->numLenses;
+	cache->openingAngle = e->openingAngle;
+	cache->root = root;
+}
+
+/*
+ * Slot index to start probing from for a corner
+ */
+static int jacobianSlot(jacobianCache *cache, uint64_t x, uint64_t y)
+{
+	uint64_t h = x*0x9E3779B97F4A7C15ULL + y;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return (int)(h & (uint64_t)(cache->capacity - 1));
+}
+
+/*
+ * Finds the slot holding a corner, or the empty slot where it belongs.
+ * Slots are empty when their sign is 0.
+ */
+static jacobianEntry *findCorner(jacobianCache *cache, uint64_t x, uint64_t y)
+{
+	int s = jacobianSlot(cache, x, y);
+	while (cache->entries[s].sign != 0 && (cache->entries[s].x != x || cache->entries[s].y != y))
+		s = (s + 1) & (cache->capacity - 1);
+	return &cache->entries[s];
+}
+
+/*
+ * Doubles the table size, keeping the current entries
+ */
+static boolean growJacobianCache(jacobianCache *cache)
+{
+	int oldCapacity = cache->capacity;
+	jacobianEntry *old = cache->entries;
+	jacobianEntry *entries = calloc(2*oldCapacity, sizeof(jacobianEntry));
+	if (entries == NULL)
+		return FALSE;
+	
+	cache->entries = entries;
+	cache->capacity = 2*oldCapacity;
+	
+	int k;
+	for (k=0; k < oldCapacity; k++)
+		if (old[k].sign != 0)
+			*findCorner(cache, old[k].x, old[k].y) = old[k];
+	free(old);
+	return TRUE;
+}
+
+/*
+ * Returns the cached sign of the jacobian at corner (cx, cy) of the lattice
+ * of a level, or 0 if it is not known
+ */
+int cachedCornerSign(jacobianCache *cache, int level, uint64_t cx, uint64_t cy)
+{
+	int shift = JACOBIAN_LATTICE_DEPTH - (level - 1);
+	if (cache == NULL || shift < 0)
+		return 0;
+	return findCorner(cache, cx << shift, cy << shift)->sign;
+}
+
+/*
+ * Adds the sign of the jacobian at corner (cx, cy) of the lattice of a level
+ * to the cache, if there is room
+ */
+void storeCornerSign(jacobianCache *cache, int level, uint64_t cx, uint64_t cy, int sign)
+{
+	int shift = JACOBIAN_LATTICE_DEPTH - (level - 1);
+	if (cache == NULL || shift < 0)
+		return;
+	
+	if (2*(cache->count + 1) > cache->capacity)
+	{
+		if (cache->count >= MAX_ENTRIES)
+			clearJacobianCache(cache);
+		else if (!growJacobianCache(cache))
+			return;
+	}
+	
+	jacobianEntry *e = findCorner(cache, cx << shift, cy << shift);
+	if (e->sign == 0)
+	{
+		e->x = cx << shift;
+		e->y = cy << shift;
+		e->sign = (signed char)sign;
+		cache->count++;
+	}
+}
+
+/*
+ * Finds the sign of the jacobian at the four corners of a grid, in corner order.
+ * Corners not already in the cache are evaluated together and added to it.
+ * Returns the number of corners that had to be evaluated.
+ */
+int cellCornerSigns(jacobianCache *cache, searchGrid grid, int *signs)
+{
+	uint64_t x[4], y[4];
+	point pending[4];
+	int index[4];
+	int numPending = 0;
+	int i;
+	
+	for (i=0; i < 4; i++)
+	{
+		// BOTTOM_LEFT, TOP_LEFT, TOP_RIGHT, BOTTOM_RIGHT
+		x[i] = grid.ix + (i == TOP_RIGHT || i == BOTTOM_RIGHT);
+		y[i] = grid.iy + (i == TOP_LEFT || i == TOP_RIGHT);
+		
+		signs[i] = cachedCornerSign(cache, grid.level, x[i], y[i]);
+		if (signs[i] == 0)
+		{
+			pending[numPending] = areaCorner(grid.searchArea, (corner)i);
+			index[numPending++] = i;
+		}
+	}
+	
+	if (numPending == 0)
+		return 0;
+	
+	double jacobian[4];
+	lensJacobians(grid.event, pending, jacobian, numPending);
+	for (i=0; i < numPending; i++)
+	{
+		int c = index[i];
+		signs[c] = (jacobian[i] > 0) ? 1 : -1;
+		storeCornerSign(cache, grid.level, x[c], y[c], signs[c]);
+	}
+	return numPending;
+}
@@ -0,0 +1,71 @@
+/*
+ * jacobiancache.h
+ * Lattice cache of the lens equation jacobian sign at cell corners.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef JACOBIANCACHE_HEADER
+#define JACOBIANCACHE_HEADER
+
+#include <stdint.h>
+
+/*
+ * Corners are addressed on a dyadic lattice covering the root search area
+ * with 2^JACOBIAN_LATTICE_DEPTH steps per side, so a corner shared by cells
+ * of different levels has a single key.
+ */
+#define JACOBIAN_LATTICE_DEPTH 60
+
+typedef struct jacobianEntry {
+	uint64_t x;
+	uint64_t y;
+	signed char sign;
+} jacobianEntry;
+
+/*
+ * The jacobian depends only on the lenses, so the cache is kept between
+ * searches for as long as the lenses and root search area are unchanged.
+ */
+typedef struct jacobianCache {
+	jacobianEntry *entries;
+	int capacity;
+	int count;
+	
+	// The configuration the cached values belong to
+	searchArea root;
+	double openingAngle;
+	int numLenses;
+	lens *lenses;
+} jacobianCache;
+
+// Function declarations
+jacobianCache *newJacobianCache(void);
+void freeJacobianCache(jacobianCache *cache);
+void validateJacobianCache(jacobianCache *cache, searchArea root, event *e);
+int cachedCornerSign(jacobianCache *cache, int level, uint64_t cx, uint64_t cy);
+void storeCornerSign(jacobianCache *cache, int level, uint64_t cx, uint64_t cy, int sign);
+int cellCornerSigns(jacobianCache *cache, searchGrid grid, int *signs);
+#endif
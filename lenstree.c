@@ -0,0 +1,435 @@
+/*
+ * lenstree.c
+ * Barnes-Hut tree of lenses for fast deflection by large lens populations.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "typedefs.h"
+#include "lenstree.h"
+
+// Nodes with this many lenses or fewer are summed directly
+#define LEAF_LENSES 8
+
+// Stop dividing (e.g. for coincident lenses) below this depth
+#define MAX_DEPTH 48
+
+/*
+ * Adds a node to the tree, returning its index or -1 if there is no memory
+ */
+static int addNode(lensTree *tree)
+{
+	if (tree->numNodes == tree->maxNodes)
+	{
+		int newMax = (tree->maxNodes > 0) ? 2*tree->maxNodes : 256;
+		lensNode *nodes = realloc(tree->nodes, newMax*sizeof(lensNode));
+		if (nodes == NULL)
+			return -1;
+		tree->nodes = nodes;
+		tree->maxNodes = newMax;
+	}
+	
+	lensNode *n = &tree->nodes[tree->numNodes];
+	memset(n, 0, sizeof(lensNode));
+	n->children[0] = n->children[1] = n->children[2] = n->children[3] = -1;
+	return tree->numNodes++;
+}
+
+/*
+ * Swaps lenses i and j in the tree order
+ */
+static void swapLenses(lensTree *tree, int i, int j)
+{
+	double t;
+	t = tree->x[i]; tree->x[i] = tree->x[j]; tree->x[j] = t;
+	t = tree->y[i]; tree->y[i] = tree->y[j]; tree->y[j] = t;
+	t = tree->mass[i]; tree->mass[i] = tree->mass[j]; tree->mass[j] = t;
+}
+
+/*
+ * Builds the node for lenses [first, first+count) inside the square (x, y, size),
+ * sorting the lenses into quadrant order. Returns the node index or -1 on failure
+ */
+static int buildNode(lensTree *tree, int first, int count, double x, double y, double size, int depth)
+{
+	int n = addNode(tree);
+	if (n < 0)
+		return -1;
+	
+	int last = first + count;
+	int i, k;
+	
+	tree->nodes[n].first = first;
+	tree->nodes[n].count = count;
+	
+	if (count > LEAF_LENSES && depth < MAX_DEPTH)
+	{
+		// Partition the lenses into quadrants 0 bottom left, 1 bottom right, 2 top left, 3 top right
+		double half = size/2;
+		int start = first;
+		int q;
+		for (q=0; q < 4; q++)
+		{
+			int end = start;
+			for (i=start; i < last; i++)
+			{
+				int quadrant = (tree->x[i] >= x + half) + 2*(tree->y[i] >= y + half);
+				if (quadrant == q)
+					swapLenses(tree, i, end++);
+			}
+			
+			if (end > start)
+			{
+				int child = buildNode(tree, start, end - start, x + (q & 1)*half, y + (q >> 1)*half, half, depth + 1);
+				if (child < 0)
+					return -1;
+				tree->nodes[n].children[q] = child;
+			}
+			start = end;
+		}
+	}
+	
+	// Centre of mass and extent
+	lensNode *node = &tree->nodes[n];
+	double totalMass = 0, cx = 0, cy = 0;
+	node->minX = node->maxX = tree->x[first];
+	node->minY = node->maxY = tree->y[first];
+	for (i=first; i < last; i++)
+	{
+		totalMass += tree->mass[i];
+		cx += tree->mass[i]*tree->x[i];
+		cy += tree->mass[i]*tree->y[i];
+		node->minX = fmin(node->minX, tree->x[i]);
+		node->maxX = fmax(node->maxX, tree->x[i]);
+		node->minY = fmin(node->minY, tree->y[i]);
+		node->maxY = fmax(node->maxY, tree->y[i]);
+	}
+	if (totalMass != 0)
+		node->centre = makePoint(cx/totalMass, cy/totalMass);
+	else
+		node->centre = makePoint((node->minX + node->maxX)/2, (node->minY + node->maxY)/2);
+	
+	node->radius = 0;
+	for (i=first; i < last; i++)
+		node->radius = fmax(node->radius, hypot(tree->x[i] - node->centre.x, tree->y[i] - node->centre.y));
+	
+	// Multipole moments a_k = sum m_i (z_i - c)^k
+	for (i=first; i < last; i++)
+	{
+		double dx = tree->x[i] - node->centre.x;
+		double dy = tree->y[i] - node->centre.y;
+		double px = tree->mass[i], py = 0;
+		for (k=0; k <= LENS_TREE_ORDER; k++)
+		{
+			node->momentX[k] += px;
+			node->momentY[k] += py;
+			double t = px*dx - py*dy;
+			py = px*dy + py*dx;
+			px = t;
+		}
+	}
+	return n;
+}
+
+/*
+ * Builds a tree over the given lenses. Nodes are only expanded when seen from
+ * further than radius/openingAngle; smaller angles are slower but more accurate.
+ * Returns NULL if there is not enough memory
+ */
+lensTree *buildLensTree(lens *lenses, int numLenses, double openingAngle)
+{
+	if (numLenses <= 0)
+		return NULL;
+	
+	lensTree *tree = calloc(1, sizeof(lensTree));
+	if (tree == NULL)
+		return NULL;
+	
+	tree->openingAngle = openingAngle;
+	tree->x = malloc(numLenses*sizeof(double));
+	tree->y = malloc(numLenses*sizeof(double));
+	tree->mass = malloc(numLenses*sizeof(double));
+	if (tree->x == NULL || tree->y == NULL || tree->mass == NULL)
+	{
+		freeLensTree(tree);
+		return NULL;
+	}
+	
+	int i;
+	double minX = lenses[0].origin.x, maxX = minX;
+	double minY = lenses[0].origin.y, maxY = minY;
+	for (i=0; i < numLenses; i++)
+	{
+		tree->x[i] = lenses[i].origin.x;
+		tree->y[i] = lenses[i].origin.y;
+		tree->mass[i] = lenses[i].mass;
+		minX = fmin(minX, lenses[i].origin.x);
+		maxX = fmax(maxX, lenses[i].origin.x);
+		minY = fmin(minY, lenses[i].origin.y);
+		maxY = fmax(maxY, lenses[i].origin.y);
+	}
+	
+	// Slightly enlarge the root square so that every lens is strictly inside it
+	double size = fmax(maxX - minX, maxY - minY);
+	size = (size > 0) ? size*(1 + 1e-9) : 1;
+	
+	if (buildNode(tree, 0, numLenses, minX, minY, size, 0) < 0)
+	{
+		fprintf(stderr, "Error: cannot allocate lens tree\n");
+		freeLensTree(tree);
+		return NULL;
+	}
+	return tree;
+}
+
+/*
+ * Releases a lens tree
+ */
+void freeLensTree(lensTree *tree)
+{
+	if (tree == NULL)
+		return;
+	free(tree->nodes);
+	free(tree->x);
+	free(tree->y);
+	free(tree->mass);
+	free(tree);
+}
+
+/*
+ * Evaluates f(z) = sum m_i/(z - z_i) and its derivative at z = (x, y), using the
+ * multipole expansion of every node that is far enough away
+ */
+static void evaluateTree(lensTree *tree, double x, double y, double *f, double *df)
+{
+	int stack[4*MAX_DEPTH + 4];
+	int top = 0;
+	int i, k;
+	double fx = 0, fy = 0, dfx = 0, dfy = 0;
+	double theta2 = tree->openingAngle*tree->openingAngle;
+	
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		lensNode *node = &tree->nodes[stack[--top]];
+		double dx = x - node->centre.x;
+		double dy = y - node->centre.y;
+		double d2 = dx*dx + dy*dy;
+		
+		if (node->radius*node->radius < theta2*d2)
+		{
+			// Far away: with u = 1/(z - c), f = u sum a_k u^k and f' = -u^2 sum (k+1) a_k u^k
+			double ux = dx/d2, uy = -dy/d2;
+			double sx = node->momentX[LENS_TREE_ORDER], sy = node->momentY[LENS_TREE_ORDER];
+			double tx = (LENS_TREE_ORDER + 1)*sx, ty = (LENS_TREE_ORDER + 1)*sy;
+			for (k=LENS_TREE_ORDER - 1; k >= 0; k--)
+			{
+				double t = sx*ux - sy*uy + node->momentX[k];
+				sy = sx*uy + sy*ux + node->momentY[k];
+				sx = t;
+				t = tx*ux - ty*uy + (k + 1)*node->momentX[k];
+				ty = tx*uy + ty*ux + (k + 1)*node->momentY[k];
+				tx = t;
+			}
+			double u2x = ux*ux - uy*uy, u2y = 2*ux*uy;
+			fx += sx*ux - sy*uy;
+			fy += sx*uy + sy*ux;
+			dfx -= tx*u2x - ty*u2y;
+			dfy -= tx*u2y + ty*u2x;
+			continue;
+		}
+		
+		boolean leaf = TRUE;
+		for (i=0; i < 4; i++)
+		{
+			if (node->children[i] >= 0)
+			{
+				stack[top++] = node->children[i];
+				leaf = FALSE;
+			}
+		}
+		
+		if (leaf)
+		{
+			// Direct sum: m/(z - z_i) and -m/(z - z_i)^2
+			for (i=node->first; i < node->first + node->count; i++)
+			{
+				double lx = x - tree->x[i];
+				double ly = y - tree->y[i];
+				double l2 = lx*lx + ly*ly;
+				double ux = lx/l2, uy = -ly/l2;
+				fx += tree->mass[i]*ux;
+				fy += tree->mass[i]*uy;
+				dfx -= tree->mass[i]*(ux*ux - uy*uy);
+				dfy -= tree->mass[i]*2*ux*uy;
+			}
+		}
+	}
+	f[0] = fx;
+	f[1] = fy;
+	df[0] = dfx;
+	df[1] = dfy;
+}
+
+/*
+ * Maps count image plane points to the source plane: w = z - conj(f(z))
+ */
+void lensTreeDeflect(lensTree *tree, const point *in, point *out, int count)
+{
+	int i;
+	for (i=0; i < count; i++)
+	{
+		double f[2], df[2];
+		evaluateTree(tree, in[i].x, in[i].y, f, df);
+		out[i].x = in[i].x - f[0];
+		out[i].y = in[i].y + f[1];
+	}
+}
+
+/*
+ * Evaluates the jacobian determinant 1 - |f'(z)|^2 at count points
+ */
+void lensTreeJacobians(lensTree *tree, const point *in, double *jacobian, int count)
+{
+	int i;
+	for (i=0; i < count; i++)
+	{
+		double f[2], df[2];
+		evaluateTree(tree, in[i].x, in[i].y, f, df);
+		jacobian[i] = 1 - (df[0]*df[0] + df[1]*df[1]);
+	}
+}
+
+/*
+ * Returns TRUE if any lens lies inside the area (including its edges)
+ */
+boolean lensTreeHasLensInArea(lensTree *tree, searchArea a)
+{
+	int stack[4*MAX_DEPTH + 4];
+	int top = 0;
+	int i;
+	
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		lensNode *node = &tree->nodes[stack[--top]];
+		if (node->maxX < a.x || node->minX > a.x + a.size || node->maxY < a.y || node->minY > a.y + a.size)
+			continue;
+		
+		boolean leaf = TRUE;
+		for (i=0; i < 4; i++)
+		{
+			if (node->children[i] >= 0)
+			{
+				stack[top++] = node->children[i];
+				leaf = FALSE;
+			}
+		}
+		
+		if (leaf)
+		{
+			for (i=node->first; i < node->first + node->count; i++)
+				if (pointInArea(makePoint(tree->x[i], tree->y[i]), a))
+					return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Distance from a point to the rectangle [minX, maxX] x [minY, maxY]
+ */
+static double distanceToRectangle(double x, double y, double minX, double minY, double maxX, double maxY)
+{
+	double dx = fmax(minX - x, fmax(0, x - maxX));
+	double dy = fmax(minY - y, fmax(0, y - maxY));
+	return hypot(dx, dy);
+}
+
+/*
+ * Returns 1/d^power
+ */
+static double inversePower(double d, int power)
+{
+	double p = 1;
+	int i;
+	for (i=0; i < power; i++)
+		p *= d;
+	return 1/p;
+}
+
+/*
+ * Returns an upper bound on sum m_i/d_i^power over the lenses, where d_i is the
+ * distance from lens i to the rectangle [minX, maxX] x [minY, maxY].
+ * Distant nodes are bounded by their total mass and nearest possible lens
+ */
+double lensTreeInverseDistanceSum(lensTree *tree, double minX, double minY, double maxX, double maxY, int power)
+{
+	int stack[4*MAX_DEPTH + 4];
+	int top = 0;
+	int i;
+	double bound = 0;
+	
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		lensNode *node = &tree->nodes[stack[--top]];
+		
+		// Gap between the rectangle and the bounding box of the node's lenses
+		double gx = fmax(node->minX - maxX, fmax(0, minX - node->maxX));
+		double gy = fmax(node->minY - maxY, fmax(0, minY - node->maxY));
+		double gap = hypot(gx, gy);
+		double extent = fmax(node->maxX - node->minX, node->maxY - node->minY);
+		if (gap > 0 && extent < tree->openingAngle*gap)
+		{
+			bound += node->momentX[0]*inversePower(gap, power);
+			continue;
+		}
+		
+		boolean leaf = TRUE;
+		for (i=0; i < 4; i++)
+		{
+			if (node->children[i] >= 0)
+			{
+				stack[top++] = node->children[i];
+				leaf = FALSE;
+			}
+		}
+		
+		if (leaf)
+		{
+			for (i=node->first; i < node->first + node->count; i++)
+			{
+				double d = distanceToRectangle(tree->x[i], tree->y[i], minX, minY, maxX, maxY);
+				bound += tree->mass[i]*inversePower(d, power);
+			}
+		}
+	}
+	return bound;
+}
@@ -0,0 +1,72 @@
+/*
+ * lenstree.h
+ * Barnes-Hut tree of lenses for fast deflection by large lens populations.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef LENSTREE_HEADER
+#define LENSTREE_HEADER
+
+// Number of multipole terms kept for each node
+#define LENS_TREE_ORDER 10
+
+/*
+ * In complex notation the lens equation is w = z - conj(f(z)) with
+ * f(z) = sum m_i/(z - z_i). Far from a group of lenses f is given by the
+ * multipole expansion sum a_k/(z - c)^(k+1), a_k = sum m_i (z_i - c)^k.
+ */
+typedef struct lensNode {
+	point centre;
+	double radius;
+	double minX;
+	double minY;
+	double maxX;
+	double maxY;
+	int first;
+	int count;
+	int children[4];
+	double momentX[LENS_TREE_ORDER + 1];
+	double momentY[LENS_TREE_ORDER + 1];
+} lensNode;
+
+typedef struct lensTree {
+	lensNode *nodes;
+	int numNodes;
+	int maxNodes;
+	double *x;
+	double *y;
+	double *mass;
+	double openingAngle;
+} lensTree;
+
+// Function declarations
+lensTree *buildLensTree(lens *lenses, int numLenses, double openingAngle);
+void freeLensTree(lensTree *tree);
+void lensTreeDeflect(lensTree *tree, const point *in, point *out, int count);
+void lensTreeJacobians(lensTree *tree, const point *in, double *jacobian, int count);
+boolean lensTreeHasLensInArea(lensTree *tree, searchArea a);
+double lensTreeInverseDistanceSum(lensTree *tree, double minX, double minY, double maxX, double maxY, int power);
+#endif
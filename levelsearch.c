@@ -0,0 +1,390 @@
+/*
+ * levelsearch.c
+ * Level-synchronous image search over Morton-ordered cell arrays.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "levelsearch.h"
+#include "deflection.h"
+#include "jacobiancache.h"
+#include "arena.h"
+#include "searchstats.h"
+
+// Divergence checks still to be made on a cell
+#define CHECK_LENSES 1
+#define CHECK_CRITICAL_CURVE 2
+
+typedef enum cellOutcome {
+	CELL_UNDECIDED = 0,
+	CELL_DISCARDED = 1,		// Contains a lens or critical curve at the resolution
+	CELL_LEAF = 2,
+	CELL_DIVIDED = 3
+} cellOutcome;
+
+/*
+ * The cells of one level of the search, in Morton (Z) order
+ */
+typedef struct cellLevel {
+	double *x;
+	double *y;
+	uint64_t *ix;
+	uint64_t *iy;
+	unsigned char *flags;
+	int count;
+	int capacity;
+} cellLevel;
+
+/*
+ * A cell corner whose jacobian sign has to be evaluated, and the slot
+ * (4*cell + corner) that receives it
+ */
+typedef struct pendingCorner {
+	uint64_t x;
+	uint64_t y;
+	int slot;
+} pendingCorner;
+
+/*
+ * Releases the arrays of a level
+ */
+static void freeCellLevel(cellLevel *l)
+{
+	free(l->x);
+	free(l->y);
+	free(l->ix);
+	free(l->iy);
+	free(l->flags);
+	memset(l, 0, sizeof(cellLevel));
+}
+
+/*
+ * Makes room for count cells in an empty level. Returns FALSE if it cannot be grown
+ */
+static boolean reserveCellLevel(cellLevel *l, int count)
+{
+	l->count = 0;
+	if (count <= l->capacity)
+		return TRUE;
+	
+	int capacity = (l->capacity > 0) ? l->capacity : 1024;
+	while (capacity < count)
+		capacity *= 2;
+	
+	double *x = realloc(l->x, capacity*sizeof(double));
+	if (x != NULL)
+		l->x = x;
+	double *y = realloc(l->y, capacity*sizeof(double));
+	if (y != NULL)
+		l->y = y;
+	uint64_t *ix = realloc(l->ix, capacity*sizeof(uint64_t));
+	if (ix != NULL)
+		l->ix = ix;
+	uint64_t *iy = realloc(l->iy, capacity*sizeof(uint64_t));
+	if (iy != NULL)
+		l->iy = iy;
+	unsigned char *flags = realloc(l->flags, capacity*sizeof(unsigned char));
+	if (flags != NULL)
+		l->flags = flags;
+	
+	if (x == NULL || y == NULL || ix == NULL || iy == NULL || flags == NULL)
+		return FALSE;
+	l->capacity = capacity;
+	return TRUE;
+}
+
+/*
+ * Appends a cell to a level with room for it
+ */
+static void appendCell(cellLevel *l, double x, double y, uint64_t ix, uint64_t iy, unsigned char flags)
+{
+	l->x[l->count] = x;
+	l->y[l->count] = y;
+	l->ix[l->count] = ix;
+	l->iy[l->count] = iy;
+	l->flags[l->count] = flags;
+	l->count++;
+}
+
+/*
+ * Returns cell k of a level as a search grid
+ */
+static searchGrid levelGrid(searchGrid root, cellLevel *l, int k, int level, double size)
+{
+	searchGrid grid = makeSearchGrid(makeSearchArea(l->x[k], l->y[k], size), root.source, root.event, root.context,
+		(l->flags[k] & CHECK_LENSES) != 0, (l->flags[k] & CHECK_CRITICAL_CURVE) != 0, level);
+	grid.ix = l->ix[k];
+	grid.iy = l->iy[k];
+	return grid;
+}
+
+/*
+ * Orders corners by position, so that corners shared by neighbouring cells are adjacent
+ */
+static int compareCorners(const void *a, const void *b)
+{
+	const pendingCorner *p = a;
+	const pendingCorner *q = b;
+	if (p->y != q->y)
+		return (p->y < q->y) ? -1 : 1;
+	if (p->x != q->x)
+		return (p->x < q->x) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Finds the sign of the jacobian at the corners of every cell of a level that
+ * still needs the critical curve check, writing them to signs in corner order.
+ * Corners missing from the jacobian cache are evaluated in one batch, once each.
+ * Returns FALSE if there is not enough scratch memory
+ */
+static boolean levelCornerSigns(searchGrid root, cellLevel *l, int level, double size, const unsigned char *outcome, signed char *signs)
+{
+	searchContext *context = root.context;
+	pendingCorner *pending = arenaAlloc(context->arena, 4*l->count*sizeof(pendingCorner));
+	if (pending == NULL)
+		return FALSE;
+	
+	int numPending = 0;
+	int k, c;
+	for (k=0; k < l->count; k++)
+	{
+		if (outcome[k] != CELL_UNDECIDED || !(l->flags[k] & CHECK_CRITICAL_CURVE))
+			continue;
+		
+		for (c=0; c < 4; c++)
+		{
+			uint64_t cx = l->ix[k] + (c == TOP_RIGHT || c == BOTTOM_RIGHT);
+			uint64_t cy = l->iy[k] + (c == TOP_LEFT || c == TOP_RIGHT);
+			signs[4*k + c] = (signed char)cachedCornerSign(context->jacobians, level, cx, cy);
+			if (signs[4*k + c] == 0)
+			{
+				pending[numPending].x = cx;
+				pending[numPending].y = cy;
+				pending[numPending++].slot = 4*k + c;
+			}
+		}
+	}
+	
+	if (numPending == 0)
+		return TRUE;
+	
+	qsort(pending, numPending, sizeof(pendingCorner), compareCorners);
+	point *corners = arenaAlloc(context->arena, numPending*sizeof(point));
+	double *jacobian = arenaAlloc(context->arena, numPending*sizeof(double));
+	if (corners == NULL || jacobian == NULL)
+		return FALSE;
+	
+	int numCorners = 0;
+	for (k=0; k < numPending; k++)
+	{
+		if (k > 0 && compareCorners(&pending[k], &pending[k - 1]) == 0)
+			continue;
+		int cell = pending[k].slot/4;
+		corners[numCorners++] = areaCorner(makeSearchArea(l->x[cell], l->y[cell], size), (corner)(pending[k].slot % 4));
+	}
+	
+	lensJacobians(root.event, corners, jacobian, numCorners);
+	context->jacobianEvaluations += numCorners;
+	
+	int n = -1;
+	for (k=0; k < numPending; k++)
+	{
+		if (k == 0 || compareCorners(&pending[k], &pending[k - 1]) != 0)
+		{
+			n++;
+			storeCornerSign(context->jacobians, level, pending[k].x, pending[k].y, (jacobian[n] > 0) ? 1 : -1);
+		}
+		signs[pending[k].slot] = (jacobian[n] > 0) ? 1 : -1;
+	}
+	return TRUE;
+}
+
+/*
+ * Classifies every cell of a level, in the same way as search(): first the
+ * lens check, then the critical curve check, then the hit test, each as one
+ * pass over the cells that are still undecided. Leaf cells are added to the
+ * results and the children of divided cells are appended to next.
+ * Returns FALSE if there is not enough scratch memory
+ */
+static boolean searchLevel(searchGrid root, cellLevel *l, int level, double size, cellLevel *next)
+{
+	searchContext *context = root.context;
+	scratchArena *arena = context->arena;
+	int n = l->count;
+	int k;
+	
+	unsigned char *outcome = arenaAlloc(arena, n*sizeof(unsigned char));
+	intersectionType *hits = arenaAlloc(arena, n*sizeof(intersectionType));
+	signed char *signs = arenaAlloc(arena, 4*n*sizeof(signed char));
+	if (outcome == NULL || hits == NULL || signs == NULL)
+		return FALSE;
+	memset(outcome, CELL_UNDECIDED, n);
+	countLevelCells(context, level, STAT_VISITED, n);
+	
+	// Every cell of a level has the same size
+	boolean atResolution = gridAtResolution(levelGrid(root, l, 0, level, size));
+	cellOutcome split = atResolution ? CELL_DISCARDED : CELL_DIVIDED;
+	
+	for (k=0; k < n; k++)
+	{
+		if (!(l->flags[k] & CHECK_LENSES))
+			continue;
+		if (containsLens(levelGrid(root, l, k, level, size)))
+		{
+			outcome[k] = split;
+			countLevelCells(context, level, STAT_LENS, 1);
+		}
+		else
+			l->flags[k] &= ~CHECK_LENSES;
+	}
+	
+	if (!levelCornerSigns(root, l, level, size, outcome, signs))
+		return FALSE;
+	for (k=0; k < n; k++)
+	{
+		if (outcome[k] != CELL_UNDECIDED || !(l->flags[k] & CHECK_CRITICAL_CURVE))
+			continue;
+		
+		signed char *s = &signs[4*k];
+		if (s[0] != s[1] || s[0] != s[2] || s[0] != s[3])
+		{
+			outcome[k] = split;
+			countLevelCells(context, level, STAT_CRITICAL_CURVE, 1);
+		}
+		else
+			l->flags[k] &= ~CHECK_CRITICAL_CURVE;
+	}
+	
+	// Bound the images of all the remaining cells from one batch of centres
+	point *centres = arenaAlloc(arena, n*sizeof(point));
+	point *images = arenaAlloc(arena, n*sizeof(point));
+	int *index = arenaAlloc(arena, n*sizeof(int));
+	if (centres == NULL || images == NULL || index == NULL)
+		return FALSE;
+	
+	int numTested = 0;
+	for (k=0; k < n; k++)
+	{
+		if (outcome[k] == CELL_UNDECIDED)
+		{
+			centres[numTested] = makePoint(l->x[k] + size/2, l->y[k] + size/2);
+			index[numTested++] = k;
+		}
+	}
+	deflectPoints(root.event, centres, images, numTested);
+	context->deflections += numTested;
+	
+	int i;
+	for (i=0; i < numTested; i++)
+	{
+		k = index[i];
+		searchGrid grid = levelGrid(root, l, k, level, size);
+		double minU, minV, maxU, maxV;
+		boundImageAround(grid, images[i], &minU, &minV, &maxU, &maxV);
+		hits[k] = boxClearOfSource(minU, minV, maxU, maxV, root.source) ? NO_OVERLAP : boundaryMapsToSource(grid);
+		context->calculations[level] += 40;
+		outcome[k] = (hits[k] == NO_OVERLAP || hits[k] == INSIDE_SOURCE || atResolution) ? CELL_LEAF : CELL_DIVIDED;
+	}
+	
+	// Children are appended in quadrant order, which keeps the next level in Morton order
+	double half = size/2;
+	for (k=0; k < n; k++)
+	{
+		if (outcome[k] == CELL_LEAF)
+			addLeafCell(levelGrid(root, l, k, level, size), hits[k]);
+		else if (outcome[k] == CELL_DIVIDED)
+		{
+			int quadrant;
+			for (quadrant=0; quadrant < 4; quadrant++)
+				appendCell(next, l->x[k] + (quadrant & 1)*half, l->y[k] + (quadrant >> 1)*half,
+					2*l->ix[k] + (quadrant & 1), 2*l->iy[k] + (quadrant >> 1), l->flags[k]);
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Finds the images of a source inside a given area, one level of the quadtree
+ * at a time. Each level is held as flat arrays of cells in Morton order and
+ * classified in batches, which gives the deflection kernels long runs of
+ * points and needs no recursion. The cells and image area are the same as
+ * from searchImages(), but leaf cells are recorded level by level.
+ * Results are accumulated into a cleared context; returns the total image area
+ */
+double searchImagesLevels(searchArea a, source *source, event *event, searchContext *context)
+{
+	beginSearch(a, event, context);
+	searchGrid root = makeSearchGrid(a, source, event, context, TRUE, TRUE, 1);
+	
+	cellLevel levels[2];
+	memset(levels, 0, sizeof(levels));
+	cellLevel *current = &levels[0];
+	cellLevel *next = &levels[1];
+	if (!reserveCellLevel(current, 1))
+	{
+		fprintf(stderr, "Error: cannot allocate search level; searching recursively\n");
+		freeCellLevel(current);
+		search(root);
+		endSearch(context);
+		return context->imageArea;
+	}
+	appendCell(current, a.x, a.y, 0, 0, CHECK_LENSES | CHECK_CRITICAL_CURVE);
+	
+	int level = 1;
+	double size = a.size;
+	while (current->count > 0)
+	{
+		arenaMark mark = arenaGetMark(context->arena);
+		if (!reserveCellLevel(next, 4*current->count) || !searchLevel(root, current, level, size, next))
+		{
+			// Finish the remaining cells the usual way; none of them has been added yet
+			fprintf(stderr, "Error: cannot allocate search level; searching recursively\n");
+			arenaRelease(context->arena, mark);
+			int k;
+			for (k=0; k < current->count; k++)
+				search(levelGrid(root, current, k, level, size));
+			break;
+		}
+		arenaRelease(context->arena, mark);
+		
+		cellLevel *swap = current;
+		current = next;
+		next = swap;
+		level++;
+		size /= 2;
+	}
+	
+	freeCellLevel(&levels[0]);
+	freeCellLevel(&levels[1]);
+	endSearch(context);
+	return context->imageArea;
+}
@@ -0,0 +1,176 @@
+/*
+ * lightcurve.c
+ * Limb-darkened finite source lightcurves.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "typedefs.h"
+#include "lightcurve.h"
+#include "batchsearch.h"
+
+/*
+ * Makes a straight source path parallel to the x axis at the given impact
+ * parameter, passing x = 0 at peakTime
+ */
+trajectory makeTrajectory(double peakTime, double crossingTime, double impactRadius)
+{
+	trajectory t;
+	t.peakTime = peakTime;
+	t.crossingTime = crossingTime;
+	t.impactRadius = impactRadius;
+	return t;
+}
+
+/*
+ * Returns the position of the source centre at a given time
+ */
+point trajectoryPosition(trajectory path, double time)
+{
+	return makePoint((time - path.peakTime)/path.crossingTime, path.impactRadius);
+}
+
+/*
+ * Flux from within radius r of the centre of a linearly limb darkened source
+ * of radius 1 and unit central intensity: I(r) = 1 - u(1 - sqrt(1 - r^2))
+ */
+static double enclosedFlux(double r, double limbCoefficient)
+{
+	double mu = sqrt(fmax(0, 1 - r*r));
+	return PI*(1 - limbCoefficient)*r*r + 2*PI*limbCoefficient/3*(1 - mu*mu*mu);
+}
+
+/*
+ * Finds the magnification of a linearly limb darkened source of each of
+ * numRadii radii at each of numTimes times along a path, writing those of
+ * radius r to magnifications[r*numTimes ...]. The source is divided into
+ * numAnnuli annuli of equal intensity drop, each taken to have its mean
+ * intensity. The image area inside every annulus radius is found for all
+ * radii and times in the same traversals, and the image flux is summed
+ * annulus by annulus. Returns FALSE if there is not enough memory
+ */
+boolean limbDarkenedLightcurves(searchArea a, event *e, searchContext *context, trajectory path, const double *radii, int numRadii,
+	double limbCoefficient, int numAnnuli, const double *times, int numTimes, double *magnifications)
+{
+	int perTime = numRadii*numAnnuli;
+	int count = numTimes*perTime;
+	source *sources = malloc(count*sizeof(source));
+	double *areas = malloc(count*sizeof(double));
+	double *edges = malloc((numAnnuli + 1)*sizeof(double));
+	double *weights = malloc(numAnnuli*sizeof(double));
+	if (sources == NULL || areas == NULL || edges == NULL || weights == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate lightcurve of %d points\n", numTimes);
+		free(sources);
+		free(areas);
+		free(edges);
+		free(weights);
+		return FALSE;
+	}
+	
+	// Annulus edges are evenly spaced in sqrt(1 - r^2), in which the intensity is linear
+	int i, r, k;
+	edges[0] = 0;
+	for (k=1; k <= numAnnuli; k++)
+	{
+		double mu = 1 - k/(double)numAnnuli;
+		edges[k] = sqrt(1 - mu*mu);
+	}
+	for (k=0; k < numAnnuli; k++)
+	{
+		double ringArea = PI*(edges[k + 1]*edges[k + 1] - edges[k]*edges[k]);
+		weights[k] = (enclosedFlux(edges[k + 1], limbCoefficient) - enclosedFlux(edges[k], limbCoefficient))/ringArea;
+	}
+	
+	// The disks of each time are neighbours in the batch, so they share traversals
+	for (i=0; i < numTimes; i++)
+		for (r=0; r < numRadii; r++)
+			for (k=0; k < numAnnuli; k++)
+				sources[i*perTime + r*numAnnuli + k] = makeSource(trajectoryPosition(path, times[i]), radii[r]*edges[k + 1]);
+	searchAreasBatch(a, sources, count, e, context, areas);
+	
+	for (r=0; r < numRadii; r++)
+	{
+		double totalFlux = radii[r]*radii[r]*enclosedFlux(1, limbCoefficient);
+		for (i=0; i < numTimes; i++)
+		{
+			double flux = 0;
+			double inner = 0;
+			for (k=0; k < numAnnuli; k++)
+			{
+				double outer = areas[i*perTime + r*numAnnuli + k];
+				flux += weights[k]*(outer - inner);
+				inner = outer;
+			}
+			magnifications[r*numTimes + i] = flux/totalFlux;
+		}
+	}
+	
+	free(sources);
+	free(areas);
+	free(edges);
+	free(weights);
+	return TRUE;
+}
+
+/*
+ * Finds the magnification of a linearly limb darkened source of the given
+ * radius at each of numTimes times along a path (see limbDarkenedLightcurves).
+ * Returns FALSE if there is not enough memory
+ */
+boolean limbDarkenedLightcurve(searchArea a, event *e, searchContext *context, trajectory path, double radius, double limbCoefficient, int numAnnuli,
+	const double *times, int numTimes, double *magnifications)
+{
+	return limbDarkenedLightcurves(a, e, context, path, &radius, 1, limbCoefficient, numAnnuli, times, numTimes, magnifications);
+}
+
+/*
+ * Writes a lightcurve as lines of "time magnification".
+ * Returns FALSE if the file cannot be written
+ */
+boolean writeLightcurve(const char *filename, const double *times, const double *magnifications, int count)
+{
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	int i;
+	for (i=0; i < count; i++)
+		fprintf(out, "%.6f %.10g\n", times[i], magnifications[i]);
+	
+	if (fclose(out) != 0)
+	{
+		fprintf(stderr, "Error: cannot write %s\n", filename);
+		return FALSE;
+	}
+	return TRUE;
+}
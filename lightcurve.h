@@ -0,0 +1,52 @@
+/*
+ * lightcurve.h
+ * Limb-darkened finite source lightcurves.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef LIGHTCURVE_HEADER
+#define LIGHTCURVE_HEADER
+
+/*
+ * A straight source path along the x axis: the source centre is at
+ * ((time - peakTime)/crossingTime, impactRadius)
+ */
+typedef struct trajectory {
+	double peakTime;
+	double crossingTime;
+	double impactRadius;
+} trajectory;
+
+// Function declarations
+trajectory makeTrajectory(double peakTime, double crossingTime, double impactRadius);
+point trajectoryPosition(trajectory path, double time);
+boolean limbDarkenedLightcurves(searchArea a, event *e, searchContext *context, trajectory path, const double *radii, int numRadii,
+	double limbCoefficient, int numAnnuli, const double *times, int numTimes, double *magnifications);
+boolean limbDarkenedLightcurve(searchArea a, event *e, searchContext *context, trajectory path, double radius, double limbCoefficient, int numAnnuli,
+	const double *times, int numTimes, double *magnifications);
+boolean writeLightcurve(const char *filename, const double *times, const double *magnifications, int count);
+#endif
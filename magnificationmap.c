@@ -0,0 +1,305 @@
+/*
+ * magnificationmap.c
+ * Source plane magnification maps, stored in tiles for mmap.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "typedefs.h"
+#include "lightcurve.h"
+#include "magnificationmap.h"
+
+// Each kernel pixel is weighted by the profile at this many points per side
+#define KERNEL_SUBSAMPLES 4
+
+/*
+ * Creates an empty (zero) map of width x height pixels with its lower left
+ * corner at (x, y) in the source plane. Returns NULL if it cannot be allocated
+ */
+magnificationMap *newMagnificationMap(double x, double y, double pixelSize, int width, int height)
+{
+	if (width <= 0 || height <= 0 || pixelSize <= 0)
+		return NULL;
+	
+	magnificationMap *map = calloc(1, sizeof(magnificationMap));
+	if (map == NULL)
+		return NULL;
+	
+	mapHeader *h = &map->header;
+	memcpy(h->magic, MAP_MAGIC, sizeof(h->magic));
+	h->byteOrder = MAP_BYTE_ORDER;
+	h->tileSize = MAP_TILE_SIZE;
+	h->width = width;
+	h->height = height;
+	h->tilesX = (width + MAP_TILE_SIZE - 1)/MAP_TILE_SIZE;
+	h->tilesY = (height + MAP_TILE_SIZE - 1)/MAP_TILE_SIZE;
+	h->x = x;
+	h->y = y;
+	h->pixelSize = pixelSize;
+	
+	long page = sysconf(_SC_PAGESIZE);
+	h->dataOffset = (page > (long)sizeof(mapHeader)) ? (uint64_t)page : sizeof(mapHeader);
+	
+	map->tiles = calloc((size_t)h->tilesX*h->tilesY*MAP_TILE_SIZE*MAP_TILE_SIZE, sizeof(float));
+	if (map->tiles == NULL)
+	{
+		free(map);
+		return NULL;
+	}
+	return map;
+}
+
+/*
+ * Releases a map, unmapping its file if it was opened from one
+ */
+void freeMagnificationMap(magnificationMap *map)
+{
+	if (map == NULL)
+		return;
+	if (map->mapping != NULL)
+		munmap(map->mapping, map->mappingSize);
+	else
+		free(map->tiles);
+	free(map);
+}
+
+/*
+ * Returns the value of pixel (px, py), or NULL if it is outside the map
+ */
+float *mapPixel(magnificationMap *map, int px, int py)
+{
+	mapHeader *h = &map->header;
+	if (px < 0 || py < 0 || px >= (int)h->width || py >= (int)h->height)
+		return NULL;
+	
+	int tile = (py/MAP_TILE_SIZE)*h->tilesX + px/MAP_TILE_SIZE;
+	return &map->tiles[(size_t)tile*MAP_TILE_SIZE*MAP_TILE_SIZE + (py % MAP_TILE_SIZE)*MAP_TILE_SIZE + px % MAP_TILE_SIZE];
+}
+
+/*
+ * Writes a map to a file that openMagnificationMap() can map into memory.
+ * Returns FALSE if it cannot be written
+ */
+boolean writeMagnificationMap(magnificationMap *map, const char *filename)
+{
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	mapHeader *h = &map->header;
+	size_t numValues = (size_t)h->tilesX*h->tilesY*MAP_TILE_SIZE*MAP_TILE_SIZE;
+	boolean ok = (fwrite(h, sizeof(mapHeader), 1, out) == 1);
+	
+	// Pad the header out to the start of the tiles
+	size_t padding;
+	for (padding=sizeof(mapHeader); ok && padding < h->dataOffset; padding++)
+		ok = (fputc(0, out) != EOF);
+	
+	ok = ok && (fwrite(map->tiles, sizeof(float), numValues, out) == numValues);
+	if (fclose(out) != 0 || !ok)
+	{
+		fprintf(stderr, "Error: cannot write %s\n", filename);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Opens a map written by writeMagnificationMap(), mapping its tiles straight
+ * from the file so that only the pages that are used are read.
+ * Returns NULL if the file cannot be mapped or is not a map from this machine
+ */
+magnificationMap *openMagnificationMap(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return NULL;
+	}
+	
+	struct stat info;
+	mapHeader h;
+	if (fstat(fd, &info) != 0 || read(fd, &h, sizeof(mapHeader)) != (ssize_t)sizeof(mapHeader) ||
+		memcmp(h.magic, MAP_MAGIC, sizeof(h.magic)) != 0 || h.byteOrder != MAP_BYTE_ORDER || h.tileSize != MAP_TILE_SIZE ||
+		h.dataOffset + (uint64_t)h.tilesX*h.tilesY*MAP_TILE_SIZE*MAP_TILE_SIZE*sizeof(float) > (uint64_t)info.st_size)
+	{
+		fprintf(stderr, "Error: %s is not a magnification map for this machine\n", filename);
+		close(fd);
+		return NULL;
+	}
+	
+	magnificationMap *map = calloc(1, sizeof(magnificationMap));
+	void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == NULL || mapping == MAP_FAILED)
+	{
+		fprintf(stderr, "Error: cannot map %s\n", filename);
+		if (mapping != MAP_FAILED)
+			munmap(mapping, info.st_size);
+		free(map);
+		return NULL;
+	}
+	
+	map->header = h;
+	map->mapping = mapping;
+	map->mappingSize = info.st_size;
+	map->tiles = (float *)((char *)mapping + h.dataOffset);
+	return map;
+}
+
+/*
+ * Makes the pixel weights of a linearly limb darkened source of the given
+ * radius on a map. Each pixel is weighted by the mean intensity over it, and
+ * the weights sum to one. Returns FALSE if out of memory
+ */
+boolean makeSourceKernel(sourceKernel *kernel, magnificationMap *map, double radius, double limbCoefficient)
+{
+	double pixelSize = map->header.pixelSize;
+	int r = (int)ceil(radius/pixelSize - 0.5);
+	int side = 2*r + 1;
+	kernel->radius = r;
+	kernel->weights = malloc(side*side*sizeof(float));
+	if (kernel->weights == NULL)
+		return FALSE;
+	
+	double total = 0;
+	int dx, dy, i, j;
+	for (dy=-r; dy <= r; dy++)
+	{
+		for (dx=-r; dx <= r; dx++)
+		{
+			double w = 0;
+			for (j=0; j < KERNEL_SUBSAMPLES; j++)
+			{
+				for (i=0; i < KERNEL_SUBSAMPLES; i++)
+				{
+					double x = (dx - 0.5 + (i + 0.5)/KERNEL_SUBSAMPLES)*pixelSize;
+					double y = (dy - 0.5 + (j + 0.5)/KERNEL_SUBSAMPLES)*pixelSize;
+					double s = (x*x + y*y)/(radius*radius);
+					if (s <= 1)
+						w += 1 - limbCoefficient*(1 - sqrt(1 - s));
+				}
+			}
+			kernel->weights[(dy + r)*side + dx + r] = (float)w;
+			total += w;
+		}
+	}
+	
+	// A source smaller than a pixel samples the pixel it falls in
+	if (total == 0)
+	{
+		kernel->weights[r*side + r] = 1;
+		total = 1;
+	}
+	for (i=0; i < side*side; i++)
+		kernel->weights[i] = (float)(kernel->weights[i]/total);
+	return TRUE;
+}
+
+/*
+ * Releases the weights of a kernel
+ */
+void freeSourceKernel(sourceKernel *kernel)
+{
+	free(kernel->weights);
+	kernel->weights = NULL;
+}
+
+/*
+ * Magnification of the source centred on pixel (px, py), or NAN if the source
+ * reaches outside the map
+ */
+static double convolvePixel(magnificationMap *map, sourceKernel *kernel, int px, int py)
+{
+	int r = kernel->radius;
+	int side = 2*r + 1;
+	if (px - r < 0 || py - r < 0 || px + r >= (int)map->header.width || py + r >= (int)map->header.height)
+		return NAN;
+	
+	double sum = 0;
+	int dx, dy;
+	for (dy=-r; dy <= r; dy++)
+	{
+		const float *w = &kernel->weights[(dy + r)*side];
+		
+		// A row is contiguous within each tile it crosses
+		int x = px - r;
+		const float *m = mapPixel(map, x, py + dy);
+		for (dx=-r; dx <= r; dx++, x++)
+		{
+			if (x % MAP_TILE_SIZE == 0)
+				m = mapPixel(map, x, py + dy);
+			sum += w[dx + r]**m++;
+		}
+	}
+	return sum;
+}
+
+/*
+ * Returns the magnification of the source described by kernel centred at p,
+ * interpolating between the four nearest pixel centres. Returns NAN if the
+ * source reaches outside the map
+ */
+double mapMagnification(magnificationMap *map, sourceKernel *kernel, point p)
+{
+	mapHeader *h = &map->header;
+	double u = (p.x - h->x)/h->pixelSize - 0.5;
+	double v = (p.y - h->y)/h->pixelSize - 0.5;
+	double fu = floor(u);
+	double fv = floor(v);
+	if (!(fu >= 0 && fv >= 0 && fu + 1 < h->width && fv + 1 < h->height))
+		return NAN;
+	
+	int px = (int)fu;
+	int py = (int)fv;
+	double tu = u - fu;
+	double tv = v - fv;
+	return (1 - tv)*((1 - tu)*convolvePixel(map, kernel, px, py) + tu*convolvePixel(map, kernel, px + 1, py)) +
+		tv*((1 - tu)*convolvePixel(map, kernel, px, py + 1) + tu*convolvePixel(map, kernel, px + 1, py + 1));
+}
+
+/*
+ * Samples the magnification of a source along a trajectory at each of
+ * numTimes times. Points where the source leaves the map are NAN
+ */
+void mapLightcurve(magnificationMap *map, sourceKernel *kernel, trajectory path, const double *times, int numTimes, double *magnifications)
+{
+	int i;
+	for (i=0; i < numTimes; i++)
+		magnifications[i] = mapMagnification(map, kernel, trajectoryPosition(path, times[i]));
+}
@@ -0,0 +1,93 @@
+/*
+ * magnificationmap.h
+ * Source plane magnification maps, stored in tiles for mmap.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef MAGNIFICATIONMAP_HEADER
+#define MAGNIFICATIONMAP_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAP_MAGIC "MAGMAP1"
+#define MAP_BYTE_ORDER 0x01020304
+#define MAP_TILE_SIZE 64
+
+/*
+ * The file starts with this header, followed at dataOffset (a multiple of
+ * the page size) by the tiles in row order. Each tile holds
+ * tileSize x tileSize float magnifications in row order, so the pixels near
+ * a track share a few pages of the mapping. Values are in the byte order of
+ * the machine that wrote them, which byteOrder identifies.
+ */
+typedef struct mapHeader {
+	char magic[8];
+	uint32_t byteOrder;
+	uint32_t tileSize;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tilesX;
+	uint32_t tilesY;
+	
+	// Source plane position of the lower left corner, and the pixel side
+	double x;
+	double y;
+	double pixelSize;
+	
+	uint64_t dataOffset;
+} mapHeader;
+
+typedef struct magnificationMap {
+	mapHeader header;
+	float *tiles;
+	
+	// Set when tiles points into a mapped file rather than allocated memory
+	void *mapping;
+	size_t mappingSize;
+} magnificationMap;
+
+/*
+ * Weights of the pixels around a source centre, for a given source size and
+ * limb darkening: weights[(dy + radius)*(2*radius + 1) + dx + radius]
+ */
+typedef struct sourceKernel {
+	int radius;
+	float *weights;
+} sourceKernel;
+
+// Function declarations
+magnificationMap *newMagnificationMap(double x, double y, double pixelSize, int width, int height);
+void freeMagnificationMap(magnificationMap *map);
+float *mapPixel(magnificationMap *map, int px, int py);
+boolean writeMagnificationMap(magnificationMap *map, const char *filename);
+magnificationMap *openMagnificationMap(const char *filename);
+boolean makeSourceKernel(sourceKernel *kernel, magnificationMap *map, double radius, double limbCoefficient);
+void freeSourceKernel(sourceKernel *kernel);
+double mapMagnification(magnificationMap *map, sourceKernel *kernel, point p);
+void mapLightcurve(magnificationMap *map, sourceKernel *kernel, trajectory path, const double *times, int numTimes, double *magnifications);
+#endif
@@ -35,16 +35,180 @@
 
 #include "typedefs.h"
 #include "searchgrid.h"
+#include "deflection.h"
+#include "searchtree.h"
+#include "pointsource.h"
+#include "lightcurve.h"
+#include "criticalcurves.h"
+#include "searchstats.h"
+#include "raster.h"
+#include "displaylist.h"
+#include "magnificationmap.h"
+#include "rayshoot.h"
 
 #define MAX_LIGHTCURVE_POINTS 3000
+#define LIMB_ANNULI 10
+
+// Pixels on each side of the frames written with -r
+#define RENDER_SIDE 512
+
+// Maps written with -m: pixels per source radius, margin round the track in
+// source radii, and ray shooting noise per pixel at unit magnification
+#define MAP_PIXELS_PER_RADIUS 10
+#define MAP_MARGIN 2
+#define MAP_NOISE 0.1
+
+// Curves are thinned to points this fraction of the window apart
+#define CURVE_RESOLUTION 1e-3
 #include <gsl/gsl_poly.h>
 #include <float.h>
 
-boolean debugMode = FALSE;
+/*
+ * Writes the statistics of the searches to <eventName>.stats.json, .stats.csv
+ * and .trace.json
+ */
+static void writeSearchStats(const char *eventName, searchStats *stats)
+{
+	char statsFile[100];
+	snprintf(statsFile, sizeof(statsFile), "%s.stats.json", eventName);
+	writeStatsJSON(stats, statsFile);
+	snprintf(statsFile, sizeof(statsFile), "%s.stats.csv", eventName);
+	writeStatsCSV(stats, statsFile);
+	snprintf(statsFile, sizeof(statsFile), "%s.trace.json", eventName);
+	writeChromeTrace(stats, statsFile);
+}
 
-#define LEVELS 1000
-double eliminated[1000];
-int calculations[1000];
+/*
+ * Writes the numeric images of each animation frame to <eventName>.<frame>.png
+ * without opening PGPLOT
+ */
+static boolean renderAnimation(const char *eventName, searchArea a, event *e, searchContext *context, searchTree *tree,
+	source s, point startPoint, point endPoint, int animationFrames)
+{
+	unsigned char *pixels = malloc(RENDER_SIDE*RENDER_SIDE);
+	if (pixels == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate frame\n");
+		return FALSE;
+	}
+	
+	boolean ok = TRUE;
+	int i;
+	for (i=0; i <= animationFrames && ok; i++)
+	{
+		if (animationFrames > 0)
+			s.origin = interpolatePosition(startPoint, endPoint, i/(double)animationFrames);
+		searchImagesIncremental(a, &s, e, context, tree);
+		
+		char frameFile[100];
+		snprintf(frameFile, sizeof(frameFile), "%s.%04d.png", eventName, i);
+		ok = renderImageCells(context->cells, context->numCells, context->root, a, RENDER_SIDE, pixels) &&
+			writePNG(frameFile, pixels, RENDER_SIDE, RENDER_SIDE);
+	}
+	free(pixels);
+	return ok;
+}
+
+/*
+ * Shoots a magnification map around the source track into <eventName>.map,
+ * maps the file back into memory and samples the lightcurve from it into
+ * <eventName>.map.lightcurve. If searched is not NULL, prints the largest
+ * relative difference from that lightcurve
+ */
+static boolean writeTrackMap(const char *eventName, searchArea a, event *e, trajectory path, double sourceRadius, double limbCoefficient,
+	const double *times, const double *searched, int numTimes)
+{
+	point first = trajectoryPosition(path, times[0]);
+	point last = trajectoryPosition(path, times[numTimes - 1]);
+	double margin = MAP_MARGIN*sourceRadius;
+	double pixelSize = sourceRadius/MAP_PIXELS_PER_RADIUS;
+	double x = fmin(first.x, last.x) - margin;
+	double y = fmin(first.y, last.y) - margin;
+	int width = (int)ceil((fabs(last.x - first.x) + 2*margin)/pixelSize);
+	int height = (int)ceil((fabs(last.y - first.y) + 2*margin)/pixelSize);
+	
+	char mapFile[100];
+	snprintf(mapFile, sizeof(mapFile), "%s.map", eventName);
+	magnificationMap *map = newMagnificationMap(x, y, pixelSize, width, height);
+	if (map == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate magnification map\n");
+		return FALSE;
+	}
+	
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	boolean ok = shootMagnificationMap(map, e, a, MAP_NOISE, 0) && writeMagnificationMap(map, mapFile);
+	freeMagnificationMap(map);
+	if (!ok)
+		return FALSE;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Shot a %dx%d map into %s in %.2fs\n", width, height, mapFile, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)*1e-9);
+	
+	// Sample the lightcurve from the file, as a fit would
+	map = openMagnificationMap(mapFile);
+	if (map == NULL)
+		return FALSE;
+	
+	sourceKernel kernel;
+	double *magnifications = malloc(numTimes*sizeof(double));
+	if (magnifications == NULL || !makeSourceKernel(&kernel, map, sourceRadius, limbCoefficient))
+	{
+		fprintf(stderr, "Error: cannot allocate map lightcurve\n");
+		free(magnifications);
+		freeMagnificationMap(map);
+		return FALSE;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	mapLightcurve(map, &kernel, path, times, numTimes, magnifications);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Sampled %d points from the map in %.1fus each\n", numTimes,
+		((end.tv_sec - start.tv_sec)*1e6 + (end.tv_nsec - start.tv_nsec)*1e-3)/numTimes);
+	
+	if (searched != NULL)
+	{
+		double maxDifference = 0;
+		int j;
+		for (j=0; j < numTimes; j++)
+			maxDifference = fmax(maxDifference, fabs(magnifications[j] - searched[j])/searched[j]);
+		printf("Map lightcurve differs from the searched one by at most %.2f%%\n", 100*maxDifference);
+	}
+	
+	char lightcurveFile[100];
+	snprintf(lightcurveFile, sizeof(lightcurveFile), "%s.map.lightcurve", eventName);
+	ok = writeLightcurve(lightcurveFile, times, magnifications, numTimes);
+	
+	freeSourceKernel(&kernel);
+	free(magnifications);
+	freeMagnificationMap(map);
+	return ok;
+}
+
+/*
+ * Draws the parts of a display list inside the current window
+ */
+static void drawDisplayList(const displayList *list)
+{
+	int *runStarts = malloc(list->numChunks*sizeof(int));
+	int *runCounts = malloc(list->numChunks*sizeof(int));
+	if (list->numChunks > 0 && (runStarts == NULL || runCounts == NULL))
+	{
+		fprintf(stderr, "Error: cannot allocate curve runs\n");
+		free(runStarts);
+		free(runCounts);
+		return;
+	}
+	
+	float x1, x2, y1, y2;
+	cpgqwin(&x1, &x2, &y1, &y2);
+	int numRuns = visibleRuns(list, (x1 < x2) ? x1 : x2, (x1 < x2) ? x2 : x1, (y1 < y2) ? y1 : y2, (y1 < y2) ? y2 : y1, runStarts, runCounts);
+	int i;
+	for (i=0; i < numRuns; i++)
+		cpgline(runCounts[i], &list->x[runStarts[i]], &list->y[runStarts[i]]);
+	free(runStarts);
+	free(runCounts);
+}
 
 int main(int argc, char **argv)
 {	
@@ -78,38 +242,75 @@ int main(int argc, char **argv)
 	point startPoint = makePoint((startTime - peakTime)/crossingTime, impactRadius);
 	point endPoint = makePoint((endTime - peakTime)/crossingTime, impactRadius);
 	source s = makeSource(startPoint, sourceRadius);
-
-
-	/*
-	 * Load caustic and critical curve data from Gravlens
-	 */
-		char dataLine[100];
 	
-	#define MAX_CAUSTIC_POINTS 10000
-	float causticX[MAX_CAUSTIC_POINTS][2];
-	float causticY[MAX_CAUSTIC_POINTS][2];
-	float criticalX[MAX_CAUSTIC_POINTS][2];
-	float criticalY[MAX_CAUSTIC_POINTS][2];
-	int totalCausticPoints = 0;
+	boolean debugMode = FALSE;
+	int j;
+	searchContext context;
+	initSearchContext(&context, TRUE);
 	
-	FILE *curveData = fopen("gravlens.curves", "r");
-	
-	if(curveData == NULL) {
-		printf("Error: cannot open gravlens.curves\n");
-		return EXIT_FAILURE;
+	// With -s, statistics of every search are written on quit.
+	// With -r, the frames are written as images instead of shown.
+	// With -m, the lightcurve is also sampled from a shot magnification map, and nothing is shown
+	boolean renderFrames = FALSE;
+	boolean mapTrack = FALSE;
+	for (j=1; j < argc; j++)
+	{
+		if (strcmp(argv[j], "-s") == 0)
+			context.stats = newSearchStats();
+		else if (strcmp(argv[j], "-r") == 0)
+			renderFrames = TRUE;
+		else if (strcmp(argv[j], "-m") == 0)
+			mapTrack = TRUE;
 	}
 	
-	while(fgets(dataLine, 100, curveData) != NULL)
+	// Successive frames only move the source, so update the previous search tree
+	searchTree tree;
+	initSearchTree(&tree);
+	
+	/*
+	 * Write the lightcurve over the animation
+	 */
+	int numLightcurvePoints = (animationFrames + 1 < MAX_LIGHTCURVE_POINTS) ? animationFrames + 1 : MAX_LIGHTCURVE_POINTS;
+	double lightcurveTimes[MAX_LIGHTCURVE_POINTS];
+	double lightcurve[MAX_LIGHTCURVE_POINTS];
+	for (j=0; j < numLightcurvePoints; j++)
+		lightcurveTimes[j] = startTime + (endTime - startTime)*j/(double)((numLightcurvePoints > 1) ? numLightcurvePoints - 1 : 1);
+	
+	char lightcurveFile[100];
+	snprintf(lightcurveFile, sizeof(lightcurveFile), "%s.lightcurve", eventName);
+	trajectory path = makeTrajectory(peakTime, crossingTime, impactRadius);
+	boolean searched = limbDarkenedLightcurve(a, &e, &context, path, sourceRadius, limbcoefficient,
+		(limbcoefficient > 0) ? LIMB_ANNULI : 1, lightcurveTimes, numLightcurvePoints, lightcurve);
+	if (searched)
+		writeLightcurve(lightcurveFile, lightcurveTimes, lightcurve, numLightcurvePoints);
+	
+	if (renderFrames || mapTrack)
 	{
-		if (totalCausticPoints >= MAX_CAUSTIC_POINTS)
-		{
-			printf("ERROR: Caustic data overruns point arrays");
-			break;
-		}
-		sscanf(dataLine, "%f %f %f %f %f %f %f %f\n", &criticalX[totalCausticPoints][0], &criticalY[totalCausticPoints][0], &causticX[totalCausticPoints][0], &causticY[totalCausticPoints][0], &criticalX[totalCausticPoints][1], &criticalY[totalCausticPoints][1], &causticX[totalCausticPoints][1], &causticY[totalCausticPoints][1]);
-		totalCausticPoints++;
+		boolean rendered = !mapTrack || writeTrackMap(eventName, a, &e, path, sourceRadius, limbcoefficient,
+			lightcurveTimes, searched ? lightcurve : NULL, numLightcurvePoints);
+		if (renderFrames)
+			rendered = renderAnimation(eventName, a, &e, &context, &tree, s, startPoint, endPoint, animationFrames) && rendered;
+		if (context.stats != NULL)
+			writeSearchStats(eventName, context.stats);
+		freeSearchStats(context.stats);
+		freeSearchContext(&context);
+		freeSearchTree(&tree);
+		freeEvent(&e);
+		return rendered ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
-	fclose(curveData);
+
+	/*
+	 * Trace the critical and caustic curves of the lenses
+	 */
+	criticalCurves *curves = eventCriticalCurves(&e);
+	if (curves == NULL)
+		return EXIT_FAILURE;
+	
+	// Kept as display lists, thinned to the drawing resolution
+	displayList criticalList, causticList;
+	if (!makeDisplayList(curves->critical, curves->starts, curves->numCurves, CURVE_RESOLUTION*windowW, &criticalList) ||
+		!makeDisplayList(curves->caustic, curves->starts, curves->numCurves, CURVE_RESOLUTION*windowW, &causticList))
+		return EXIT_FAILURE;
 	
 	/*
 	 * Image plane window setup
@@ -125,17 +326,19 @@ int main(int argc, char **argv)
 	// Set the window area to the search area above
 	cpgwnad((float)a.x, (float)(a.x+a.size), (float)a.y, (float)(a.y+a.size));
 
-	int i = 0, j;
+	int maxImages = maxPointImages(&e);
+	pointImage *analyticImages = malloc(maxImages*sizeof(pointImage));
+	if (analyticImages == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate point source images\n");
+		return EXIT_FAILURE;
+	}
+	
+	int i = 0;
 	float x,y;
 	char c;
 	cpgslct(IPWindow);
 	
-	int jj;
-	for (jj = 0; jj < LEVELS; jj++)
-	{
-		eliminated[jj] == 0;
-	}
-	
 	do
 	{
 		switch (c)
@@ -168,34 +371,59 @@ int main(int argc, char **argv)
 		cpgsfs(2); //outline
 		
 		if (!debugMode) {
-			int ii;
 			// cpgcirc(0, 0, 1); // Draw Einstein ring
-			for (ii = 0; ii < totalCausticPoints; ii++) {
-				cpgline(2, criticalX[ii], criticalY[ii]);
-			}
-
+			drawDisplayList(&criticalList);
 			cpgsci(9);
-			for (ii = 0; ii < totalCausticPoints; ii++) {
-				cpgline(2, causticX[ii], causticY[ii]);
-			}
+			drawDisplayList(&causticList);
 		}
 
 		cpgsfs(1); // fill
 		
-		// Place source, and find images (drawing is done inside search();)
+		// Place source, and find images
 		if (animationFrames > 0)
 			s.origin = interpolatePosition(startPoint, endPoint, i/(double)animationFrames);
 		
 		cpgsci(2); // Red
 		cpgcirc((float)s.origin.x, (float)s.origin.y, (float)s.radius); // Draw Source disk
 		
-		clock_t startT = clock();
-		clock_t analyticT;
-		clock_t numericT;
+		searchImagesIncremental(a, &s, &e, &context, &tree);
 		
-		search(makeSearchGrid(a, &s, &e, TRUE, TRUE, 1));
-		numericT = clock()-startT;
-		startT = clock();
+		// Draw the numeric images, and the search grid in debug mode
+		for (j=0; j < context.numCells; j++)
+		{
+			imageCell cell = context.cells[j];
+			searchArea area = imageCellArea(context.root, cell);
+			if (cell.type != NO_OVERLAP)
+			{
+				cpgsci(1); // white
+				cpgrect(area.x, area.x + area.size, area.y, area.y + area.size);
+			}
+			
+			if (debugMode)
+			{
+				cpgsci(1);
+				cpgsfs(2); //outline
+				cpgrect(area.x, area.x + area.size, area.y, area.y + area.size);
+				cpgsfs(1); // fill
+				
+				if (cell.type == NO_OVERLAP && cell.level < 6)
+				{
+					char buf[4];
+					sprintf(buf, "%d", cell.level);
+					cpgsci(2);
+					cpgtext(area.x + area.size/2 - 0.04, area.y + area.size/2 - 0.04, buf);
+				}
+			}
+		}
+
+		// Draw the semi-analytic images of the source centre
+		int numAnalyticImages = pointSourceImages(&e, s.origin, analyticImages, maxImages);
+		
+		cpgsci(3); // Green
+		cpgsfs(2); // outline
+		for (j=0; j < numAnalyticImages; j++)
+			cpgcirc((float)analyticImages[j].position.x, (float)analyticImages[j].position.y, (float)(windowW/100));
+		cpgsfs(1); // fill
 
 		// Draw lenses
 		cpgsci(8); // Yellow
@@ -211,21 +439,23 @@ int main(int argc, char **argv)
 		cpgebuf(); // Draw buffer to screen
 
 		cpgslct(IPWindow);
-		
-		double totalArea = 0;
-		int totalCalc = 0;
-		for (jj = 1; jj < 20; jj++)
-		{
-			totalArea += eliminated[jj]/16.0;
-			totalCalc += calculations[jj];
-			//printf("%d %.6f %d\n", jj, totalArea, totalCalc);
-		}
 	} while (cpgcurs(&x,&y,&c));
 endloop:;
 	
 	
 	//time(&end);
 	cpgend();
+	if (context.stats != NULL)
+	{
+		writeSearchStats(eventName, context.stats);
+		freeSearchStats(context.stats);
+	}
+	free(analyticImages);
+	freeDisplayList(&criticalList);
+	freeDisplayList(&causticList);
+	freeSearchContext(&context);
+	freeSearchTree(&tree);
+	freeEvent(&e);
 	//printf("runTime:%f",difftime(end,start));
 	
 	return EXIT_SUCCESS;
@@ -0,0 +1,591 @@
+/*
+ * parallelsearch.c
+ * Multithreaded work-stealing image search.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "parallelsearch.h"
+#include "edgecache.h"
+#include "jacobiancache.h"
+#include "arena.h"
+#include "searchstats.h"
+
+// Each thread should start with roughly this many subtrees to balance the load
+#define TASKS_PER_THREAD 16
+#define MAX_SPLIT_LEVEL 7
+
+// A running task hands the subtrees this many levels below it to new tasks,
+// unless they are within MIN_TASK_LEVELS of the resolution and too small to share
+#define SPAWN_LEVELS 3
+#define MIN_TASK_LEVELS 6
+
+/*
+ * A subtree searched by one worker. Its cells are merged where a serial search
+ * would have recorded them: after the first cellOffset cells of its parent.
+ */
+typedef struct searchTask {
+	searchGrid grid;
+	searchContext results;
+	int cellOffset;
+	struct searchTask *firstChild;
+	struct searchTask *lastChild;
+	struct searchTask *next;
+} searchTask;
+
+/*
+ * A double ended queue of tasks.
+ * The owning thread pushes and pops at the bottom, idle threads steal from the top.
+ */
+typedef struct taskDeque {
+	pthread_mutex_t lock;
+	searchTask **tasks;
+	int top;
+	int bottom;
+	int capacity;
+} taskDeque;
+
+typedef struct workerPool {
+	taskDeque *deques;
+	jacobianCache **jacobians;
+	searchStats **stats;
+	int numThreads;
+	int lastSplitLevel;
+	
+	// Tasks waiting in the deques, and tasks not yet finished
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	int queued;
+	int unfinished;
+} workerPool;
+
+typedef struct worker {
+	workerPool *pool;
+	int id;
+} worker;
+
+/*
+ * Makes room for count more tasks at the bottom of a deque.
+ * Returns FALSE if there is not enough memory.
+ */
+static boolean reserveTasks(taskDeque *d, int count)
+{
+	if (d->top > 0 && d->bottom + count > d->capacity)
+	{
+		memmove(d->tasks, d->tasks + d->top, (d->bottom - d->top)*sizeof(searchTask *));
+		d->bottom -= d->top;
+		d->top = 0;
+	}
+	
+	if (d->bottom + count <= d->capacity)
+		return TRUE;
+	
+	int newCapacity = (d->capacity > 0) ? 2*d->capacity : 64;
+	while (newCapacity < d->bottom + count)
+		newCapacity *= 2;
+	
+	searchTask **tasks = realloc(d->tasks, newCapacity*sizeof(searchTask *));
+	if (tasks == NULL)
+		return FALSE;
+	d->tasks = tasks;
+	d->capacity = newCapacity;
+	return TRUE;
+}
+
+/*
+ * Queues a task on a worker's deque, where idle threads can steal it.
+ * Returns FALSE if there is not enough memory.
+ */
+static boolean queueTask(workerPool *pool, int id, searchTask *task)
+{
+	// Count the task before it can be taken, so no thread sees all work finished early
+	pthread_mutex_lock(&pool->lock);
+	pool->unfinished++;
+	pthread_mutex_unlock(&pool->lock);
+	
+	taskDeque *d = &pool->deques[id];
+	pthread_mutex_lock(&d->lock);
+	boolean queued = reserveTasks(d, 1);
+	if (queued)
+		d->tasks[d->bottom++] = task;
+	pthread_mutex_unlock(&d->lock);
+	
+	pthread_mutex_lock(&pool->lock);
+	if (queued)
+	{
+		pool->queued++;
+		pthread_cond_signal(&pool->changed);
+	}
+	else
+		pool->unfinished--;
+	pthread_mutex_unlock(&pool->lock);
+	return queued;
+}
+
+/*
+ * Adds a subtree to be searched later by a worker thread. The task divides
+ * grid, which has already been examined.
+ */
+void deferSearch(searchTasks *tasks, searchGrid grid)
+{
+	searchTask *task = malloc(sizeof(searchTask));
+	if (task != NULL)
+	{
+		task->grid = grid;
+		task->cellOffset = grid.context->numCells;
+		initSearchContext(&task->results, grid.context->recordCells);
+		task->firstChild = NULL;
+		task->lastChild = NULL;
+		task->next = NULL;
+		if (tasks->worker >= 0 && !queueTask(tasks->pool, tasks->worker, task))
+		{
+			free(task);
+			task = NULL;
+		}
+	}
+	
+	if (task == NULL)
+	{
+		// Fall back to searching the subtree immediately
+		fprintf(stderr, "Error: cannot allocate search task\n");
+		searchTasks *saved = grid.context->tasks;
+		grid.context->tasks = NULL;
+		divideAndConquer(grid);
+		grid.context->tasks = saved;
+		return;
+	}
+	
+	// Only the thread running the parent adds its children, so the order is that of a serial search
+	if (tasks->parent->lastChild != NULL)
+		tasks->parent->lastChild->next = task;
+	else
+		tasks->parent->firstChild = task;
+	tasks->parent->lastChild = task;
+	tasks->numTasks++;
+}
+
+/*
+ * Returns the number of online processors
+ */
+int defaultThreadCount(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+}
+
+/*
+ * Takes the newest task from a worker's own deque, or NULL if it is empty
+ */
+static searchTask *popTask(taskDeque *d)
+{
+	searchTask *task = NULL;
+	pthread_mutex_lock(&d->lock);
+	if (d->bottom > d->top)
+		task = d->tasks[--d->bottom];
+	pthread_mutex_unlock(&d->lock);
+	return task;
+}
+
+/*
+ * Takes the oldest (and largest) task from another worker's deque, or NULL if it is empty
+ */
+static searchTask *stealTask(taskDeque *d)
+{
+	searchTask *task = NULL;
+	pthread_mutex_lock(&d->lock);
+	if (d->bottom > d->top)
+		task = d->tasks[d->top++];
+	pthread_mutex_unlock(&d->lock);
+	return task;
+}
+
+/*
+ * Searches a task's subtree into its own results, using the worker's caches.
+ * Subtrees far enough below it are queued as new tasks.
+ */
+static void runTask(worker *w, searchTask *task, edgeCache *cache, scratchArena *arena)
+{
+	workerPool *pool = w->pool;
+	searchTasks spawned = {pool, task, w->id, 0};
+	
+	searchGrid grid = task->grid;
+	grid.context = &task->results;
+	grid.context->cache = cache;
+	grid.context->arena = arena;
+	grid.context->jacobians = pool->jacobians[w->id];
+	grid.context->stats = pool->stats[w->id];
+	grid.context->splitLevel = grid.level + 1 + SPAWN_LEVELS;
+	if (grid.context->splitLevel <= pool->lastSplitLevel)
+		grid.context->tasks = &spawned;
+	
+	divideAndConquer(grid);
+	flushCellStats(grid.context);
+	grid.context->cache = NULL;
+	grid.context->arena = NULL;
+	grid.context->jacobians = NULL;
+	grid.context->stats = NULL;
+	grid.context->tasks = NULL;
+}
+
+/*
+ * Worker thread: search tasks from our own deque, then steal from the others.
+ * Running tasks may queue more, so a worker with nothing to take waits until
+ * either a task is queued or every task has finished.
+ */
+static void *runWorker(void *arg)
+{
+	worker *w = arg;
+	workerPool *pool = w->pool;
+	
+	// Mapped edges and scratch memory are shared between the subtrees searched by a thread
+	edgeCache *cache = newEdgeCache();
+	scratchArena *arena = newScratchArena();
+	
+	for (;;)
+	{
+		searchTask *task = popTask(&pool->deques[w->id]);
+		
+		int i;
+		for (i=1; task == NULL && i < pool->numThreads; i++)
+			task = stealTask(&pool->deques[(w->id + i) % pool->numThreads]);
+		
+		if (task != NULL)
+		{
+			pthread_mutex_lock(&pool->lock);
+			pool->queued--;
+			pthread_mutex_unlock(&pool->lock);
+			
+			runTask(w, task, cache, arena);
+			
+			pthread_mutex_lock(&pool->lock);
+			if (--pool->unfinished == 0)
+				pthread_cond_broadcast(&pool->changed);
+			pthread_mutex_unlock(&pool->lock);
+			continue;
+		}
+		
+		pthread_mutex_lock(&pool->lock);
+		while (pool->queued <= 0 && pool->unfinished > 0)
+			pthread_cond_wait(&pool->changed, &pool->lock);
+		boolean done = (pool->unfinished == 0);
+		pthread_mutex_unlock(&pool->lock);
+		if (done)
+			break;
+	}
+	freeEdgeCache(cache);
+	freeScratchArena(arena);
+	return NULL;
+}
+
+/*
+ * Counts the cells recorded by the descendants of a task
+ */
+static long countTaskCells(const searchTask *parent)
+{
+	long count = 0;
+	const searchTask *task;
+	for (task = parent->firstChild; task != NULL; task = task->next)
+		count += task->results.numCells + countTaskCells(task);
+	return count;
+}
+
+/*
+ * Copies the cells of a context and of its tasks into out, in the order a
+ * serial search records them: each task's cells go where it was deferred.
+ * Returns the number of cells copied.
+ */
+static int orderTaskCells(imageCell *out, const searchContext *results, const searchTask *parent)
+{
+	int count = 0;
+	int copied = 0;
+	const searchTask *task;
+	for (task = parent->firstChild; task != NULL; task = task->next)
+	{
+		int offset = (task->cellOffset < results->numCells) ? task->cellOffset : results->numCells;
+		memcpy(out + count, results->cells + copied, (offset - copied)*sizeof(imageCell));
+		count += offset - copied;
+		copied = offset;
+		count += orderTaskCells(out + count, &task->results, task);
+	}
+	memcpy(out + count, results->cells + copied, (results->numCells - copied)*sizeof(imageCell));
+	return count + results->numCells - copied;
+}
+
+/*
+ * Adds the totals of a task's descendants to a context, freeing them
+ */
+static void mergeTasks(searchContext *context, searchTask *parent)
+{
+	searchTask *task = parent->firstChild;
+	while (task != NULL)
+	{
+		searchTask *next = task->next;
+		mergeSearchCounters(context, &task->results);
+		mergeTasks(context, task);
+		freeSearchContext(&task->results);
+		free(task);
+		task = next;
+	}
+}
+
+/*
+ * Merges the results of every task into the context that deferred them, with
+ * the cells in serial search order, and frees the tasks
+ */
+static void mergeTaskResults(searchContext *context, searchTask *root)
+{
+	long numCells = context->numCells + countTaskCells(root);
+	if (context->recordCells && numCells > context->numCells)
+	{
+		imageCell *cells = (numCells <= INT_MAX) ? malloc(numCells*sizeof(imageCell)) : NULL;
+		if (cells == NULL)
+		{
+			fprintf(stderr, "Error: cannot allocate image cell buffer\n");
+			context->recordCells = FALSE;
+		}
+		else
+		{
+			orderTaskCells(cells, context, root);
+			free(context->cells);
+			context->cells = cells;
+			context->numCells = (int)numCells;
+			context->maxCells = (int)numCells;
+		}
+	}
+	mergeTasks(context, root);
+}
+
+/*
+ * Makes sure the context holds a jacobian cache for each worker thread, valid
+ * for the given lenses and root area. The calling thread uses the main cache.
+ * Returns FALSE if there is not enough memory.
+ */
+static boolean prepareWorkerJacobians(searchContext *context, searchArea a, event *event, int numThreads, jacobianCache **jacobians)
+{
+	int i;
+	if (context->numWorkerJacobians < numThreads - 1)
+	{
+		jacobianCache **caches = realloc(context->workerJacobians, (numThreads - 1)*sizeof(jacobianCache *));
+		if (caches == NULL)
+			return FALSE;
+		
+		for (i=context->numWorkerJacobians; i < numThreads - 1; i++)
+			caches[i] = NULL;
+		context->workerJacobians = caches;
+		context->numWorkerJacobians = numThreads - 1;
+	}
+	
+	jacobians[0] = context->jacobians;
+	for (i=1; i < numThreads; i++)
+	{
+		if (context->workerJacobians[i-1] == NULL)
+			context->workerJacobians[i-1] = newJacobianCache();
+		if (context->workerJacobians[i-1] != NULL)
+			validateJacobianCache(context->workerJacobians[i-1], a, event);
+		jacobians[i] = context->workerJacobians[i-1];
+	}
+	return TRUE;
+}
+
+/*
+ * Finds the images of a source inside a given area using numThreads threads
+ * (or one per processor if numThreads <= 0).
+ *
+ * The top levels of the tree are searched serially, and the subtrees below
+ * them are shared between the threads. Threads split deep subtrees further
+ * as they search them, so that a subtree holding most of the work (along a
+ * caustic crossing, say) is still shared. Each task accumulates into its own
+ * context. These are merged with the cells placed where a serial search
+ * records them, so the image area and cells are those of searchImages()
+ * whatever the number of threads or the scheduling.
+ */
+double searchImagesParallel(searchArea a, source *source, event *event, searchContext *context, int numThreads)
+{
+	if (numThreads <= 0)
+		numThreads = defaultThreadCount();
+	
+	if (numThreads == 1)
+		return searchImages(a, source, event, context);
+	
+	beginSearch(a, event, context);
+	
+	taskDeque *deques = calloc(numThreads, sizeof(taskDeque));
+	worker *workers = malloc(numThreads*sizeof(worker));
+	pthread_t *threads = malloc(numThreads*sizeof(pthread_t));
+	jacobianCache **jacobians = malloc(numThreads*sizeof(jacobianCache *));
+	searchStats **stats = calloc(numThreads, sizeof(searchStats *));
+	
+	int i;
+	if (deques == NULL || workers == NULL || threads == NULL || jacobians == NULL || stats == NULL ||
+		!prepareWorkerJacobians(context, a, event, numThreads, jacobians))
+	{
+		// Not enough memory to run in parallel
+		fprintf(stderr, "Error: cannot allocate parallel search state\n");
+		free(deques);
+		free(workers);
+		free(threads);
+		free(jacobians);
+		free(stats);
+		search(makeSearchGrid(a, source, event, context, TRUE, TRUE, 1));
+		endSearch(context);
+		return context->imageArea;
+	}
+	
+	// Split where there are enough subtrees to keep every thread busy
+	int splitLevel = 1;
+	int cellsAtLevel = 1;
+	while (cellsAtLevel < TASKS_PER_THREAD*numThreads && splitLevel < MAX_SPLIT_LEVEL)
+	{
+		splitLevel++;
+		cellsAtLevel *= 4;
+	}
+	
+	// Level at which cells reach the resolution
+	int resolutionLevel = 1;
+	double size = a.size;
+	while (size > event->resolution && resolutionLevel < MAX_SEARCH_LEVELS - 1)
+	{
+		size /= 2;
+		resolutionLevel++;
+	}
+	
+	workerPool pool;
+	pool.deques = deques;
+	pool.jacobians = jacobians;
+	pool.stats = stats;
+	pool.numThreads = numThreads;
+	pool.lastSplitLevel = resolutionLevel - MIN_TASK_LEVELS;
+	pool.queued = 0;
+	pool.unfinished = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.changed, NULL);
+	for (i=0; i < numThreads; i++)
+	{
+		pthread_mutex_init(&deques[i].lock, NULL);
+		workers[i].pool = &pool;
+		workers[i].id = i;
+	}
+	
+	// The top levels are searched into the context itself, collecting the subtrees below
+	searchTask root;
+	root.firstChild = NULL;
+	root.lastChild = NULL;
+	searchTasks topTasks = {&pool, &root, -1, 0};
+	context->tasks = &topTasks;
+	context->splitLevel = splitLevel;
+	search(makeSearchGrid(a, source, event, context, TRUE, TRUE, 1));
+	context->tasks = NULL;
+	
+	int numTasks = topTasks.numTasks;
+	boolean dealt = (numTasks > 0);
+	for (i=0; i < numThreads && dealt; i++)
+		dealt = reserveTasks(&deques[i], (int)((long)numTasks*(i+1)/numThreads) - (int)((long)numTasks*i/numThreads));
+	
+	if (dealt)
+	{
+		// Each thread collects statistics on its own, to be merged afterwards
+		stats[0] = context->stats;
+		for (i=1; i < numThreads && context->stats != NULL; i++)
+		{
+			stats[i] = newSearchStats();
+			if (stats[i] != NULL)
+				beginStatsFrame(stats[i], NULL);
+		}
+		
+		// Deal out contiguous blocks of subtrees so neighbouring cells share a thread
+		searchTask *task = root.firstChild;
+		for (i=0; i < numThreads; i++)
+		{
+			int first = (int)((long)numTasks*i/numThreads);
+			int last = (int)((long)numTasks*(i+1)/numThreads);
+			int j;
+			
+			// The owner pops from the bottom, so store the block in reverse
+			for (j=first; j < last; j++, task = task->next)
+				deques[i].tasks[last - 1 - j] = task;
+			deques[i].bottom = last - first;
+		}
+		pool.queued = numTasks;
+		pool.unfinished = numTasks;
+		
+		int started = 0;
+		for (i=1; i < numThreads; i++)
+		{
+			if (pthread_create(&threads[i], NULL, runWorker, &workers[i]) != 0)
+				break;
+			started++;
+		}
+		
+		// The calling thread is worker 0; any threads that failed to start have their work stolen
+		runWorker(&workers[0]);
+		for (i=1; i <= started; i++)
+			pthread_join(threads[i], NULL);
+		
+		for (i=1; i < numThreads; i++)
+		{
+			if (stats[i] == NULL)
+				continue;
+			endStatsFrame(stats[i], NULL);
+			mergeWorkerStats(context->stats, stats[i], i);
+			freeSearchStats(stats[i]);
+		}
+	}
+	else if (numTasks > 0)
+	{
+		// Not enough memory to share the subtrees: search them here without splitting further
+		fprintf(stderr, "Error: cannot allocate parallel search state\n");
+		stats[0] = context->stats;
+		pool.lastSplitLevel = 0;
+		searchTask *task;
+		for (task = root.firstChild; task != NULL; task = task->next)
+			runTask(&workers[0], task, context->cache, context->arena);
+	}
+	
+	mergeTaskResults(context, &root);
+	
+	for (i=0; i < numThreads; i++)
+	{
+		pthread_mutex_destroy(&deques[i].lock);
+		free(deques[i].tasks);
+	}
+	pthread_mutex_destroy(&pool.lock);
+	pthread_cond_destroy(&pool.changed);
+	
+	free(deques);
+	free(workers);
+	free(threads);
+	free(jacobians);
+	free(stats);
+	endSearch(context);
+	return context->imageArea;
+}
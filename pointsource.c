@@ -0,0 +1,344 @@
+/*
+ * pointsource.c
+ * Semi-analytic point source images from the lens equation polynomial.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_poly.h>
+#include "typedefs.h"
+#include "pointsource.h"
+
+// Roots are accepted as images if they satisfy the lens equation to this accuracy
+#define IMAGE_TOLERANCE 1e-6
+
+// Newton iterations used to polish each root against the complex polynomial
+#define POLISH_ITERATIONS 4
+
+/*
+ * Multiplies the polynomials a (degree na) and b (degree nb) into out (degree na+nb).
+ * Coefficients are stored lowest order first
+ */
+static void multiplyPolynomials(const double complex *a, int na, const double complex *b, int nb, double complex *out)
+{
+	int i, j;
+	for (i=0; i <= na + nb; i++)
+		out[i] = 0;
+	for (i=0; i <= na; i++)
+		for (j=0; j <= nb; j++)
+			out[i + j] += a[i]*b[j];
+}
+
+/*
+ * Evaluates a polynomial of degree n and its derivative at z
+ */
+static double complex evaluatePolynomial(const double complex *a, int n, double complex z, double complex *derivative)
+{
+	double complex p = a[n], dp = 0;
+	int i;
+	for (i=n - 1; i >= 0; i--)
+	{
+		dp = dp*z + p;
+		p = p*z + a[i];
+	}
+	*derivative = dp;
+	return p;
+}
+
+/*
+ * Builds the lens equation polynomial for the source position zeta, returning its degree.
+ * Conjugating zeta = z - sum m_k/conj(z - z_k) gives conj(z) = A(z)/P(z), with
+ * P = prod (z - z_k) and A = conj(zeta) P + sum m_k prod_{j!=k} (z - z_j).
+ * Substituting back and clearing denominators B_k = A - conj(z_k) P gives
+ * (zeta - z) prod B_k + P sum m_k prod_{j!=k} B_j = 0, of degree N^2 + 1.
+ * out must have room for N^2 + 2 coefficients
+ */
+static int lensPolynomial(event *e, point source, double complex *out)
+{
+	int n = e->numLenses;
+	int degree = n*n + 1;
+	double complex zeta = source.x + I*source.y;
+	double complex *p = calloc(n + 1, sizeof(double complex));
+	double complex *a = calloc(n + 1, sizeof(double complex));
+	double complex *b = calloc(n*(n + 1), sizeof(double complex));
+	double complex *term = calloc(degree + 1, sizeof(double complex));
+	double complex *scratch = calloc(degree + 1, sizeof(double complex));
+	int i, j, k;
+	
+	if (p == NULL || a == NULL || b == NULL || term == NULL || scratch == NULL)
+	{
+		degree = -1;
+		goto done;
+	}
+	
+	// P(z)
+	p[0] = 1;
+	for (k=0; k < n; k++)
+	{
+		double complex zk = e->lenses[k].origin.x + I*e->lenses[k].origin.y;
+		for (i=k + 1; i > 0; i--)
+			p[i] = p[i - 1] - zk*p[i];
+		p[0] = -zk*p[0];
+	}
+	
+	// A(z); each product over j != k is P/(z - z_k), found by synthetic division
+	for (i=0; i <= n; i++)
+		a[i] = conj(zeta)*p[i];
+	for (k=0; k < n; k++)
+	{
+		double complex zk = e->lenses[k].origin.x + I*e->lenses[k].origin.y;
+		double complex c = p[n];
+		for (i=n - 1; i >= 0; i--)
+		{
+			a[i] += e->lenses[k].mass*c;
+			c = p[i] + zk*c;
+		}
+	}
+	
+	// B_k(z)
+	for (k=0; k < n; k++)
+	{
+		double complex zk = e->lenses[k].origin.x + I*e->lenses[k].origin.y;
+		for (i=0; i <= n; i++)
+			b[k*(n + 1) + i] = a[i] - conj(zk)*p[i];
+	}
+	
+	// (zeta - z) prod B_k
+	term[0] = zeta;
+	term[1] = -1;
+	int d = 1;
+	for (k=0; k < n; k++)
+	{
+		multiplyPolynomials(term, d, &b[k*(n + 1)], n, scratch);
+		d += n;
+		memcpy(term, scratch, (d + 1)*sizeof(double complex));
+	}
+	memcpy(out, term, (degree + 1)*sizeof(double complex));
+	
+	// P sum m_k prod_{j!=k} B_j
+	for (k=0; k < n; k++)
+	{
+		memcpy(term, p, (n + 1)*sizeof(double complex));
+		d = n;
+		for (j=0; j < n; j++)
+		{
+			if (j == k)
+				continue;
+			multiplyPolynomials(term, d, &b[j*(n + 1)], n, scratch);
+			d += n;
+			memcpy(term, scratch, (d + 1)*sizeof(double complex));
+		}
+		for (i=0; i <= d; i++)
+			out[i] += e->lenses[k].mass*term[i];
+	}
+	
+	// The leading terms vanish when the source lies on a lens
+	double largest = 0;
+	for (i=0; i <= degree; i++)
+		largest = fmax(largest, cabs(out[i]));
+	while (degree > 0 && cabs(out[degree]) <= 1e-14*largest)
+		degree--;
+	
+done:
+	free(p);
+	free(a);
+	free(b);
+	free(term);
+	free(scratch);
+	return degree;
+}
+
+/*
+ * The largest number of images a point source can have for this event:
+ * 5(N - 1) for N >= 2 lenses (Rhie's bound), 2 for one lens and 1 for none
+ */
+int maxPointImages(event *e)
+{
+	int n = e->numLenses;
+	return (n >= 2) ? 5*(n - 1) : n + 1;
+}
+
+/*
+ * Finds the images of a point source by solving the lens equation polynomial.
+ * Up to maxImages images are written to images, each with its signed magnification.
+ * Returns the number of images, or -1 if the polynomial could not be solved, the
+ * event has more than MAX_POINT_SOURCE_LENSES lenses, or the images found break
+ * the parity rule (the signs of the magnifications of N lenses' images sum to
+ * 1 - N), which shows that some were lost
+ */
+int pointSourceImages(event *e, point source, pointImage *images, int maxImages)
+{
+	int n = e->numLenses;
+	if (n > MAX_POINT_SOURCE_LENSES)
+		return -1;
+	if (n == 0)
+	{
+		if (maxImages < 1)
+			return 0;
+		images[0].position = source;
+		images[0].magnification = 1;
+		return 1;
+	}
+	
+	int maxDegree = n*n + 1;
+	int numImages = -1;
+	double complex *poly = calloc(maxDegree + 1, sizeof(double complex));
+	double complex *conjugate = calloc(maxDegree + 1, sizeof(double complex));
+	double complex *product = calloc(2*maxDegree + 1, sizeof(double complex));
+	double *real = calloc(2*maxDegree + 1, sizeof(double));
+	double *roots = calloc(4*maxDegree, sizeof(double));
+	gsl_poly_complex_workspace *w = NULL;
+	int i, k;
+	
+	if (poly == NULL || conjugate == NULL || product == NULL || real == NULL || roots == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate point source polynomial\n");
+		goto done;
+	}
+	
+	int degree = lensPolynomial(e, source, poly);
+	if (degree < 0)
+	{
+		fprintf(stderr, "Error: cannot allocate point source polynomial\n");
+		goto done;
+	}
+	
+	numImages = 0;
+	if (degree == 0)
+		goto done;
+	
+	// GSL only solves real polynomials, so solve poly*conj(poly) which has real
+	// coefficients and the roots of poly plus their conjugates. Roots that are not
+	// images fail the lens equation check below.
+	for (i=0; i <= degree; i++)
+		conjugate[i] = conj(poly[i]);
+	multiplyPolynomials(poly, degree, conjugate, degree, product);
+	for (i=0; i <= 2*degree; i++)
+		real[i] = creal(product[i]);
+	
+	w = gsl_poly_complex_workspace_alloc(2*degree + 1);
+	if (w == NULL || gsl_poly_complex_solve(real, 2*degree + 1, w, roots) != GSL_SUCCESS)
+	{
+		fprintf(stderr, "Error: cannot solve point source polynomial\n");
+		numImages = -1;
+		goto done;
+	}
+	
+	double complex zeta = source.x + I*source.y;
+	for (i=0; i < 2*degree && numImages < maxImages; i++)
+	{
+		double complex z = roots[2*i] + I*roots[2*i + 1];
+		
+		// Polish against the complex polynomial to recover the precision lost by squaring it
+		int iteration;
+		for (iteration=0; iteration < POLISH_ITERATIONS; iteration++)
+		{
+			double complex dp;
+			double complex p = evaluatePolynomial(poly, degree, z, &dp);
+			if (dp == 0)
+				break;
+			z -= p/dp;
+		}
+		
+		// Check the root against the lens equation: zeta = z - sum m_k/conj(z - z_k)
+		double complex mapped = z;
+		double complex shear = 0;
+		boolean onLens = FALSE;
+		for (k=0; k < n; k++)
+		{
+			double complex d = z - (e->lenses[k].origin.x + I*e->lenses[k].origin.y);
+			if (d == 0)
+			{
+				onLens = TRUE;
+				break;
+			}
+			mapped -= e->lenses[k].mass/conj(d);
+			shear += e->lenses[k].mass/(d*d);
+		}
+		if (onLens || cabs(mapped - zeta) > IMAGE_TOLERANCE)
+			continue;
+		
+		// Conjugate roots of real polynomials appear twice
+		boolean duplicate = FALSE;
+		for (k=0; k < numImages; k++)
+			if (hypot(images[k].position.x - creal(z), images[k].position.y - cimag(z)) < IMAGE_TOLERANCE)
+				duplicate = TRUE;
+		if (duplicate)
+			continue;
+		
+		double jacobian = 1 - creal(shear*conj(shear));
+		images[numImages].position = makePoint(creal(z), cimag(z));
+		images[numImages].magnification = 1/jacobian;
+		numImages++;
+	}
+	
+	int parity = 0;
+	for (i=0; i < numImages; i++)
+		parity += (images[i].magnification > 0) ? 1 : -1;
+	if (parity != 1 - n)
+		numImages = -1;
+	
+done:
+	if (w != NULL)
+		gsl_poly_complex_workspace_free(w);
+	free(poly);
+	free(conjugate);
+	free(product);
+	free(real);
+	free(roots);
+	return numImages;
+}
+
+/*
+ * Returns the total magnification of a point source, or -1 if it could not be found
+ */
+double pointSourceMagnification(event *e, point source)
+{
+	int maxImages = maxPointImages(e);
+	pointImage *images = malloc(maxImages*sizeof(pointImage));
+	if (images == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate point source images\n");
+		return -1;
+	}
+	
+	double magnification = -1;
+	int numImages = pointSourceImages(e, source, images, maxImages);
+	if (numImages >= 0)
+	{
+		int i;
+		magnification = 0;
+		for (i=0; i < numImages; i++)
+			magnification += fabs(images[i].magnification);
+	}
+	free(images);
+	return magnification;
+}
@@ -0,0 +1,271 @@
+/*
+ * raster.c
+ * Offscreen rendering of search results to image files.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "raster.h"
+
+// Largest block of a stored (uncompressed) deflate stream
+#define MAX_STORED_BLOCK 65535
+
+/*
+ * Adds the coverage of a rectangle, in pixel units from the bottom left of
+ * the raster, to the pixels it overlaps
+ */
+static void addCoverage(float *coverage, int side, double x0, double y0, double x1, double y1)
+{
+	if (x1 <= 0 || y1 <= 0 || x0 >= side || y0 >= side)
+		return;
+	x0 = fmax(x0, 0);
+	y0 = fmax(y0, 0);
+	x1 = fmin(x1, side);
+	y1 = fmin(y1, side);
+	
+	int c0 = (int)x0;
+	int c1 = (int)ceil(x1);
+	int r0 = (int)y0;
+	int r1 = (int)ceil(y1);
+	int r, c;
+	for (r=r0; r < r1; r++)
+	{
+		float *row = coverage + (size_t)r*side;
+		double height = fmin(y1, r + 1) - fmax(y0, r);
+		if (c1 - c0 == 1)
+		{
+			row[c0] += (float)((x1 - x0)*height);
+			continue;
+		}
+		
+		// Partly covered pixels at either end, whole pixels between
+		row[c0] += (float)((c0 + 1 - x0)*height);
+		for (c=c0 + 1; c < c1 - 1; c++)
+			row[c] += (float)height;
+		row[c1 - 1] += (float)((x1 - (c1 - 1))*height);
+	}
+}
+
+/*
+ * Renders the image cells of a search of root over a square view into
+ * side x side grey levels, top row first. Each pixel is the fraction of it
+ * covered by cells that are not NO_OVERLAP, so cells smaller than a pixel
+ * shade it rather than vanish. Returns FALSE if there is no memory.
+ */
+boolean renderImageCells(const imageCell *cells, int numCells, searchArea root, searchArea view, int side, unsigned char *pixels)
+{
+	float *coverage = calloc((size_t)side*side, sizeof(float));
+	if (coverage == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate %dx%d raster\n", side, side);
+		return FALSE;
+	}
+	
+	double scale = side/view.size;
+	int k;
+	for (k=0; k < numCells; k++)
+	{
+		if (cells[k].type == NO_OVERLAP)
+			continue;
+		searchArea a = imageCellArea(root, cells[k]);
+		double x0 = (a.x - view.x)*scale;
+		double y0 = (a.y - view.y)*scale;
+		addCoverage(coverage, side, x0, y0, x0 + a.size*scale, y0 + a.size*scale);
+	}
+	
+	int r, c;
+	for (r=0; r < side; r++)
+		for (c=0; c < side; c++)
+		{
+			float f = coverage[(size_t)r*side + c];
+			pixels[(size_t)(side - 1 - r)*side + c] = (unsigned char)lrintf(255*((f < 1) ? f : 1));
+		}
+	free(coverage);
+	return TRUE;
+}
+
+/*
+ * Writes grey levels, top row first, as a binary PGM file
+ */
+boolean writePGM(const char *filename, const unsigned char *pixels, int width, int height)
+{
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	fprintf(out, "P5\n%d %d\n255\n", width, height);
+	size_t written = fwrite(pixels, 1, (size_t)width*height, out);
+	if (fclose(out) != 0 || written != (size_t)width*height)
+	{
+		fprintf(stderr, "Error: cannot write %s\n", filename);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Continues the CRC-32 of a PNG chunk over more bytes
+ */
+static uint32_t pngCRC(uint32_t crc, const unsigned char *bytes, size_t count)
+{
+	size_t i;
+	int b;
+	crc = ~crc;
+	for (i=0; i < count; i++)
+	{
+		crc ^= bytes[i];
+		for (b=0; b < 8; b++)
+			crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+	}
+	return ~crc;
+}
+
+/*
+ * Stores a 32 bit value most significant byte first
+ */
+static void putBigEndian(unsigned char *bytes, uint32_t value)
+{
+	bytes[0] = (unsigned char)(value >> 24);
+	bytes[1] = (unsigned char)(value >> 16);
+	bytes[2] = (unsigned char)(value >> 8);
+	bytes[3] = (unsigned char)value;
+}
+
+/*
+ * Writes a PNG chunk. Returns FALSE if the file cannot be written
+ */
+static boolean writePNGChunk(FILE *out, const char *type, const unsigned char *data, uint32_t length)
+{
+	unsigned char word[4];
+	putBigEndian(word, length);
+	uint32_t crc = pngCRC(0, (const unsigned char *)type, 4);
+	crc = pngCRC(crc, data, length);
+	
+	boolean ok = fwrite(word, 1, 4, out) == 4 && fwrite(type, 1, 4, out) == 4 &&
+		(length == 0 || fwrite(data, 1, length, out) == length);
+	putBigEndian(word, crc);
+	return ok && fwrite(word, 1, 4, out) == 4;
+}
+
+/*
+ * Writes grey levels, top row first, as an 8 bit greyscale PNG file. The
+ * data is stored without compression, so no zlib is needed and writing
+ * runs at the speed of copying the pixels.
+ */
+boolean writePNG(const char *filename, const unsigned char *pixels, int width, int height)
+{
+	// Each row is preceded by its filter type (0, none)
+	size_t rawLength = (size_t)(width + 1)*height;
+	size_t numBlocks = (rawLength + MAX_STORED_BLOCK - 1)/MAX_STORED_BLOCK;
+	size_t dataLength = 2 + rawLength + 5*((numBlocks > 0) ? numBlocks : 1) + 4;
+	unsigned char *raw = malloc(rawLength);
+	unsigned char *data = malloc(dataLength);
+	if (raw == NULL || data == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate PNG data for %s\n", filename);
+		free(raw);
+		free(data);
+		return FALSE;
+	}
+	
+	int r;
+	for (r=0; r < height; r++)
+	{
+		raw[(size_t)r*(width + 1)] = 0;
+		memcpy(raw + (size_t)r*(width + 1) + 1, pixels + (size_t)r*width, width);
+	}
+	
+	// zlib stream of stored deflate blocks, ending with the Adler-32 of the raw data
+	size_t n = 0;
+	data[n++] = 0x78;
+	data[n++] = 0x01;
+	size_t offset = 0;
+	do
+	{
+		size_t length = (rawLength - offset < MAX_STORED_BLOCK) ? rawLength - offset : MAX_STORED_BLOCK;
+		data[n++] = (offset + length == rawLength);
+		data[n++] = (unsigned char)length;
+		data[n++] = (unsigned char)(length >> 8);
+		data[n++] = (unsigned char)~length;
+		data[n++] = (unsigned char)(~length >> 8);
+		memcpy(data + n, raw + offset, length);
+		n += length;
+		offset += length;
+	} while (offset < rawLength);
+	
+	// The sums cannot overflow within 5552 bytes, so reduce them once per run of that many
+	uint32_t s1 = 1, s2 = 0;
+	size_t i = 0;
+	while (i < rawLength)
+	{
+		size_t end = (rawLength - i < 5552) ? rawLength : i + 5552;
+		for (; i < end; i++)
+		{
+			s1 += raw[i];
+			s2 += s1;
+		}
+		s1 %= 65521;
+		s2 %= 65521;
+	}
+	putBigEndian(data + n, (s2 << 16) | s1);
+	n += 4;
+	free(raw);
+	
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		free(data);
+		return FALSE;
+	}
+	
+	// Width, height, 8 bits, greyscale, deflate, adaptive filters, not interlaced
+	unsigned char header[13] = {0, 0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0};
+	putBigEndian(header, (uint32_t)width);
+	putBigEndian(header + 4, (uint32_t)height);
+	static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	
+	boolean ok = fwrite(signature, 1, 8, out) == 8 &&
+		writePNGChunk(out, "IHDR", header, 13) &&
+		writePNGChunk(out, "IDAT", data, (uint32_t)n) &&
+		writePNGChunk(out, "IEND", NULL, 0);
+	free(data);
+	if (fclose(out) != 0 || !ok)
+	{
+		fprintf(stderr, "Error: cannot write %s\n", filename);
+		return FALSE;
+	}
+	return TRUE;
+}
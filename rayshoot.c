@@ -0,0 +1,282 @@
+/*
+ * rayshoot.c
+ * Inverse ray shooting: image plane rays binned in the source plane.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "typedefs.h"
+#include "deflection.h"
+#include "parallelsearch.h"
+#include "lightcurve.h"
+#include "magnificationmap.h"
+#include "rayshoot.h"
+
+/*
+ * The rays of a shot, and where their hits are collected. Rays lie on a
+ * uniform grid over shootArea and are handed out in square tiles of
+ * RAY_TILE x RAY_TILE, so that each batch fits in cache.
+ */
+typedef struct rayPool {
+	event *event;
+	searchArea shootArea;
+	double spacing;
+	long raysPerSide;
+	long tilesPerSide;
+	long numTiles;
+	
+	// Exactly one of these receives the hits
+	magnificationMap *map;
+	source *source;
+	
+	pthread_mutex_t lock;
+	long nextTile;
+} rayPool;
+
+/*
+ * The hits of one thread: a histogram over the map pixels (in the map's
+ * tile order), or the number of rays landing inside the source
+ */
+typedef struct rayWorker {
+	rayPool *pool;
+	uint32_t *counts;
+	long hits;
+	long rays;
+} rayWorker;
+
+/*
+ * Returns the spacing of a grid of rays that puts about raysPerArea rays
+ * in each unit of source plane area without lensing
+ */
+static double raySpacing(double raysPerArea)
+{
+	return 1/sqrt(raysPerArea);
+}
+
+/*
+ * Takes the next tile of rays, or -1 if there are none left
+ */
+static long nextRayTile(rayPool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	long tile = (pool->nextTile < pool->numTiles) ? pool->nextTile++ : -1;
+	pthread_mutex_unlock(&pool->lock);
+	return tile;
+}
+
+/*
+ * Worker thread: shoots tiles of rays until there are none left, adding the
+ * hits to its own histogram or count
+ */
+static void *runRayWorker(void *arg)
+{
+	rayWorker *w = arg;
+	rayPool *pool = w->pool;
+	point rays[RAY_TILE*RAY_TILE];
+	point hits[RAY_TILE*RAY_TILE];
+	
+	long tile;
+	while ((tile = nextRayTile(pool)) >= 0)
+	{
+		long firstX = (tile % pool->tilesPerSide)*RAY_TILE;
+		long firstY = (tile/pool->tilesPerSide)*RAY_TILE;
+		int count = 0;
+		long i, j;
+		for (j=firstY; j < firstY + RAY_TILE && j < pool->raysPerSide; j++)
+			for (i=firstX; i < firstX + RAY_TILE && i < pool->raysPerSide; i++)
+				rays[count++] = makePoint(pool->shootArea.x + (i + 0.5)*pool->spacing, pool->shootArea.y + (j + 0.5)*pool->spacing);
+		
+		deflectPoints(pool->event, rays, hits, count);
+		w->rays += count;
+		
+		int k;
+		if (pool->map != NULL)
+		{
+			mapHeader *h = &pool->map->header;
+			for (k=0; k < count; k++)
+			{
+				double u = floor((hits[k].x - h->x)/h->pixelSize);
+				double v = floor((hits[k].y - h->y)/h->pixelSize);
+				if (u >= 0 && v >= 0 && u < h->width && v < h->height)
+					w->counts[mapPixel(pool->map, (int)u, (int)v) - pool->map->tiles]++;
+			}
+		}
+		else
+		{
+			source *s = pool->source;
+			double r2 = s->radius*s->radius;
+			for (k=0; k < count; k++)
+			{
+				double dx = hits[k].x - s->origin.x;
+				double dy = hits[k].y - s->origin.y;
+				w->hits += (dx*dx + dy*dy <= r2);
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Shoots every ray of a pool with numThreads threads (the caller being one),
+ * each collecting into the histogram or count of its rayWorker.
+ * Returns FALSE if out of memory
+ */
+static boolean shootRays(rayPool *pool, int numThreads, rayWorker *workers)
+{
+	pthread_t *threads = malloc(numThreads*sizeof(pthread_t));
+	if (threads == NULL)
+		return FALSE;
+	
+	pool->tilesPerSide = (pool->raysPerSide + RAY_TILE - 1)/RAY_TILE;
+	pool->numTiles = pool->tilesPerSide*pool->tilesPerSide;
+	pool->nextTile = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	
+	int i, started = 0;
+	for (i=1; i < numThreads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, runRayWorker, &workers[i]) != 0)
+			break;
+		started++;
+	}
+	runRayWorker(&workers[0]);
+	for (i=1; i <= started; i++)
+		pthread_join(threads[i], NULL);
+	
+	pthread_mutex_destroy(&pool->lock);
+	free(threads);
+	return TRUE;
+}
+
+/*
+ * Fills a map by shooting a uniform grid of rays over shootArea in the image
+ * plane with numThreads threads (or one per processor if numThreads <= 0).
+ * The ray density puts 1/targetNoise^2 rays in each pixel without lensing, so
+ * that the Poisson noise of a pixel at unit magnification is targetNoise.
+ * The magnification of a pixel is the image plane area of the rays landing in
+ * it over its own area; shootArea must hold every image of the map area for
+ * the values to be complete. Each thread bins into its own histogram, and
+ * the histograms are summed as integers, so the result does not depend on
+ * the number of threads. Returns FALSE if out of memory
+ */
+boolean shootMagnificationMap(magnificationMap *map, event *e, searchArea shootArea, double targetNoise, int numThreads)
+{
+	if (numThreads <= 0)
+		numThreads = defaultThreadCount();
+	
+	mapHeader *h = &map->header;
+	size_t numPixels = (size_t)h->tilesX*h->tilesY*MAP_TILE_SIZE*MAP_TILE_SIZE;
+	rayPool pool;
+	memset(&pool, 0, sizeof(rayPool));
+	pool.event = e;
+	pool.shootArea = shootArea;
+	pool.map = map;
+	pool.raysPerSide = (long)ceil(shootArea.size/raySpacing(1/(targetNoise*targetNoise*h->pixelSize*h->pixelSize)));
+	pool.spacing = shootArea.size/pool.raysPerSide;
+	
+	rayWorker *workers = calloc(numThreads, sizeof(rayWorker));
+	boolean ok = (workers != NULL);
+	int i;
+	for (i=0; ok && i < numThreads; i++)
+	{
+		workers[i].pool = &pool;
+		workers[i].counts = calloc(numPixels, sizeof(uint32_t));
+		ok = (workers[i].counts != NULL);
+	}
+	
+	ok = ok && shootRays(&pool, numThreads, workers);
+	if (ok)
+	{
+		double weight = pool.spacing*pool.spacing/(h->pixelSize*h->pixelSize);
+		size_t p;
+		for (p=0; p < numPixels; p++)
+		{
+			uint64_t count = 0;
+			for (i=0; i < numThreads; i++)
+				count += workers[i].counts[p];
+			map->tiles[p] = (float)(count*weight);
+		}
+	}
+	else
+		fprintf(stderr, "Error: cannot allocate ray histograms\n");
+	
+	for (i=0; workers != NULL && i < numThreads; i++)
+		free(workers[i].counts);
+	free(workers);
+	return ok;
+}
+
+/*
+ * Finds the image area of a source by shooting a uniform grid of rays over
+ * the area a with numThreads threads (or one per processor if numThreads <= 0),
+ * for comparison with searchImages(). The ray density puts 1/targetNoise^2
+ * rays inside the source without lensing. If stats is not NULL it receives
+ * the numbers of rays shot and landing in the source. Returns -1 if out of memory
+ */
+double shootImageArea(searchArea a, source *source, event *e, double targetNoise, int numThreads, rayStats *stats)
+{
+	if (numThreads <= 0)
+		numThreads = defaultThreadCount();
+	
+	rayPool pool;
+	memset(&pool, 0, sizeof(rayPool));
+	pool.event = e;
+	pool.shootArea = a;
+	pool.source = source;
+	pool.raysPerSide = (long)ceil(a.size/raySpacing(1/(targetNoise*targetNoise*PI*source->radius*source->radius)));
+	pool.spacing = a.size/pool.raysPerSide;
+	
+	rayWorker *workers = calloc(numThreads, sizeof(rayWorker));
+	int i;
+	for (i=0; workers != NULL && i < numThreads; i++)
+		workers[i].pool = &pool;
+	if (workers == NULL || !shootRays(&pool, numThreads, workers))
+	{
+		fprintf(stderr, "Error: cannot allocate ray shooting state\n");
+		free(workers);
+		return -1;
+	}
+	
+	long rays = 0, hits = 0;
+	for (i=0; i < numThreads; i++)
+	{
+		rays += workers[i].rays;
+		hits += workers[i].hits;
+	}
+	if (stats != NULL)
+	{
+		stats->rays = rays;
+		stats->hits = hits;
+		stats->spacing = pool.spacing;
+	}
+	free(workers);
+	return hits*pool.spacing*pool.spacing;
+}
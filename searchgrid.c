@@ -27,60 +27,241 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "typedefs.h"
 #include "searchgrid.h"
-#include <cpgplot.h>
+#include "parallelsearch.h"
+#include "deflection.h"
+#include "edgecache.h"
+#include "jacobiancache.h"
+#include "lenstree.h"
+#include "arena.h"
+#include "searchstats.h"
 
+// Mapped cell edges stray from the polygon through their samples by at most
+// this fraction of the search resolution
+#define BOUNDARY_TOLERANCE 0.25
 
-extern boolean debugMode;
-extern double totalArea;
-extern double eliminated[];
-extern int calculations[];
+// Fewest segments each side of a cell is divided into
+#define MIN_EDGE_SEGMENTS 4
 
 /*
- * Finds and draws to screen the images in a given area
+ * Prepares a search context for use.
+ * If recordCells is TRUE, each search stores its leaf cells in context->cells
  */
-void search(searchGrid grid)
-{	
-	if (debugMode)
+void initSearchContext(searchContext *context, boolean recordCells)
+{
+	memset(context, 0, sizeof(searchContext));
+	context->recordCells = recordCells;
+}
+
+/*
+ * Clears the results of a previous search, keeping the cell buffer allocated
+ */
+void resetSearchContext(searchContext *context)
+{
+	context->imageArea = 0;
+	context->deflections = 0;
+	context->jacobianEvaluations = 0;
+	memset(context->eliminated, 0, sizeof(context->eliminated));
+	memset(context->calculations, 0, sizeof(context->calculations));
+	context->numCells = 0;
+	if (context->cache != NULL)
+		resetEdgeCache(context->cache);
+}
+
+/*
+ * Releases the memory owned by a search context
+ */
+void freeSearchContext(searchContext *context)
+{
+	free(context->cells);
+	context->cells = NULL;
+	context->numCells = 0;
+	context->maxCells = 0;
+	freeEdgeCache(context->cache);
+	context->cache = NULL;
+	freeScratchArena(context->arena);
+	context->arena = NULL;
+	
+	int i;
+	freeJacobianCache(context->jacobians);
+	for (i=0; i < context->numWorkerJacobians; i++)
+		freeJacobianCache(context->workerJacobians[i]);
+	free(context->workerJacobians);
+	context->jacobians = NULL;
+	context->workerJacobians = NULL;
+	context->numWorkerJacobians = 0;
+}
+
+/*
+ * Makes room for at least count more cells in the context.
+ * Returns FALSE (and stops recording) if the buffer cannot be grown
+ */
+static boolean reserveCells(searchContext *c, int count)
+{
+	if (c->numCells + count <= c->maxCells)
+		return TRUE;
+	
+	int newMax = (c->maxCells > 0) ? 2*c->maxCells : 1024;
+	while (newMax < c->numCells + count)
+		newMax *= 2;
+	
+	imageCell *newCells = realloc(c->cells, newMax*sizeof(imageCell));
+	if (newCells == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate image cell buffer\n");
+		c->recordCells = FALSE;
+		return FALSE;
+	}
+	c->cells = newCells;
+	c->maxCells = newMax;
+	return TRUE;
+}
+
+/*
+ * Appends a leaf cell to the context, growing the cell buffer as needed
+ */
+static void recordCell(searchGrid grid, intersectionType type)
+{
+	searchContext *c = grid.context;
+	if (!c->recordCells || !reserveCells(c, 1))
+		return;
+	
+	c->cells[c->numCells].ix = grid.ix;
+	c->cells[c->numCells].iy = grid.iy;
+	c->cells[c->numCells].level = (unsigned char)grid.level;
+	c->cells[c->numCells].type = (unsigned char)type;
+	c->numCells++;
+}
+
+/*
+ * Returns the area covered by a recorded cell of a search of root
+ */
+searchArea imageCellArea(searchArea root, imageCell cell)
+{
+	double size = ldexp(root.size, 1 - cell.level);
+	return makeSearchArea(root.x + cell.ix*size, root.y + cell.iy*size, size);
+}
+
+/*
+ * Adds a cell that will not be divided further to the results.
+ * Everything except NO_OVERLAP cells counts as image.
+ */
+void addLeafCell(searchGrid grid, intersectionType hit)
+{
+	double area = grid.searchArea.size*grid.searchArea.size;
+	grid.context->eliminated[grid.level] += area;
+	if (hit != NO_OVERLAP)
+		grid.context->imageArea += area;
+	recordCell(grid, hit);
+	countCell(grid, (hit == NO_OVERLAP) ? STAT_NO_OVERLAP : (hit == INSIDE_SOURCE) ? STAT_INSIDE_SOURCE : STAT_AT_RESOLUTION);
+}
+
+/*
+ * Adds the totals held in one context to those of another, leaving out the cells
+ */
+void mergeSearchCounters(searchContext *into, const searchContext *from)
+{
+	int i;
+	into->imageArea += from->imageArea;
+	into->deflections += from->deflections;
+	into->jacobianEvaluations += from->jacobianEvaluations;
+	for (i=0; i < MAX_SEARCH_LEVELS; i++)
 	{
-		// Draw Image Plane Grid
-		cpgsci(1); //yellow
-		cpgsfs(2); //outline
-		cpgrect((float)grid.searchArea.x, (float)(grid.searchArea.x+grid.searchArea.size), (float)grid.searchArea.y, (float)(grid.searchArea.y+grid.searchArea.size));
-		cpgsfs(1); // fill	
+		into->eliminated[i] += from->eliminated[i];
+		into->calculations[i] += from->calculations[i];
 	}
+}
 
+/*
+ * Adds the results held in one context to those of another
+ */
+void mergeSearchContext(searchContext *into, const searchContext *from)
+{
+	mergeSearchCounters(into, from);
+	if (into->recordCells && from->numCells > 0 && reserveCells(into, from->numCells))
+	{
+		memcpy(into->cells + into->numCells, from->cells, from->numCells*sizeof(imageCell));
+		into->numCells += from->numCells;
+	}
+}
+
+/*
+ * Clears a context ready for a new search of the area a
+ */
+void beginSearch(searchArea a, event *event, searchContext *context)
+{
+	if (context->cache == NULL)
+		context->cache = newEdgeCache();
+	if (context->arena == NULL)
+		context->arena = newScratchArena();
+	
+	if (context->jacobians == NULL)
+		context->jacobians = newJacobianCache();
+	if (context->jacobians != NULL)
+		validateJacobianCache(context->jacobians, a, event);
+	
+	resetSearchContext(context);
+	context->root = a;
+	if (context->stats != NULL)
+		beginStatsFrame(context->stats, context);
+}
+
+/*
+ * Finishes a search begun by beginSearch(), recording its statistics
+ */
+void endSearch(searchContext *context)
+{
+	if (context->stats != NULL)
+		endStatsFrame(context->stats, context);
+}
+
+/*
+ * Finds the images of a source inside a given area.
+ * Results are accumulated into a cleared context; returns the total image area
+ */
+double searchImages(searchArea a, source *source, event *event, searchContext *context)
+{
+	beginSearch(a, event, context);
+	search(makeSearchGrid(a, source, event, context, TRUE, TRUE, 1));
+	endSearch(context);
+	return context->imageArea;
+}
+
+/*
+ * Finds the images in a given area.
+ * Leaf cells and counters are accumulated into grid.context
+ */
+void search(searchGrid grid)
+{
+	// Cells that reach the resolution (or the level limit) are not divided further
+	boolean atResolution = gridAtResolution(grid);
+	countCell(grid, STAT_VISITED);
+	
 	/*
 	 * Check for divergences
 	 */
 	if (grid.checkLenses)
 	{
-		int i;
-		for (i=0; i < grid.event->numLenses; i++)
+		if (containsLens(grid))
 		{
-			if (pointInArea(grid.event->lenses[i].origin, grid.searchArea))
-			{
-				if (grid.searchArea.size > grid.event->resolution)
-					divideAndConquer(grid);
-				return;
-			}
+			countCell(grid, STAT_LENS);
+			if (!atResolution)
+				divideAndConquer(grid);
+			return;
 		}
 		grid.checkLenses = FALSE;
 	}
 	
 	if (grid.checkCriticalCurve)
 	{
-		// Check if the grid straddles a critical curve
-		// The sign of the jacobian determinant changes as you cross a critical curve
-
-		int jacobianSign = jacobianSignAtPoint(areaCorner(grid.searchArea,BOTTOM_LEFT), grid);
-		if (jacobianSign != jacobianSignAtPoint(areaCorner(grid.searchArea,TOP_LEFT), grid) ||
-			jacobianSign != jacobianSignAtPoint(areaCorner(grid.searchArea,TOP_RIGHT), grid) ||
-			jacobianSign != jacobianSignAtPoint(areaCorner(grid.searchArea,BOTTOM_RIGHT), grid))
+		if (straddlesCriticalCurve(grid))
 		{
-			if (grid.searchArea.size > grid.event->resolution)
+			countCell(grid, STAT_CRITICAL_CURVE);
+			if (!atResolution)
 				divideAndConquer(grid);
 			
 			return;
@@ -91,53 +272,80 @@ void search(searchGrid grid)
 	
 	// check for hit
 	intersectionType hit = mapsToSource(grid);
-	calculations[grid.level] += 40;
+	grid.context->calculations[grid.level] += 40;
 	
-	if (hit == NO_OVERLAP)
+	if (hit == NO_OVERLAP || hit == INSIDE_SOURCE || atResolution)
 	{
-		cpgsci(2); // white
-		eliminated[grid.level] += grid.searchArea.size*grid.searchArea.size;
-
-		if (debugMode && grid.level < 6)
-		{
-			char buf[2];
-			sprintf(buf, "%d",grid.level);
-			cpgtext(grid.searchArea.x+grid.searchArea.size/2-0.04,grid.searchArea.y+grid.searchArea.size/2-0.04, buf);
-		}
-		return;
-	}
-	
-	if (hit == INSIDE_SOURCE || grid.searchArea.size <= grid.event->resolution)
-	{
-		cpgsci(1); // white
-		eliminated[grid.level] += grid.searchArea.size*grid.searchArea.size;
-		cpgrect(grid.searchArea.x, grid.searchArea.x + grid.searchArea.size, grid.searchArea.y, grid.searchArea.y + grid.searchArea.size);
+		addLeafCell(grid, hit);
 		return;
 	}	
 	divideAndConquer(grid);
 }
 
 /*
- * Split the area into quadrants and continue searching
+ * Returns TRUE if a lens (where the lens equation diverges) lies inside the grid
  */
-void divideAndConquer(searchGrid grid)
-{		
+boolean containsLens(searchGrid grid)
+{
+	if (grid.event->lensTree != NULL)
+		return lensTreeHasLensInArea(grid.event->lensTree, grid.searchArea);
+	
+	int i;
+	for (i=0; i < grid.event->numLenses; i++)
+		if (pointInArea(grid.event->lenses[i].origin, grid.searchArea))
+			return TRUE;
+	return FALSE;
+}
+
+/*
+ * Returns TRUE if the grid straddles a critical curve.
+ * The sign of the jacobian determinant changes as you cross a critical curve
+ */
+boolean straddlesCriticalCurve(searchGrid grid)
+{
+	int signs[4];
+	grid.context->jacobianEvaluations += cellCornerSigns(grid.context->jacobians, grid, signs);
+	return (signs[0] != signs[1] || signs[0] != signs[2] || signs[0] != signs[3]);
+}
+
+/*
+ * Returns TRUE if the grid is at the search resolution (or the level limit) and should not be divided further
+ */
+boolean gridAtResolution(searchGrid grid)
+{
+	return (grid.searchArea.size <= grid.event->resolution || grid.level >= MAX_SEARCH_LEVELS - 1);
+}
+
+/*
+ * Returns one quadrant of the grid: 0 bottom left, 1 bottom right, 2 top left, 3 top right
+ */
+searchGrid childGrid(searchGrid grid, int quadrant)
+{
 	searchArea pArea = grid.searchArea;
-		
-	// Divide search area into 4
 	double newSize = pArea.size/2;
+	
+	searchArea cRect = makeSearchArea(pArea.x + (quadrant & 1)*newSize, pArea.y + (quadrant >> 1)*newSize, newSize);
+	searchGrid child = makeSearchGrid(cRect, grid.source, grid.event, grid.context, grid.checkLenses, grid.checkCriticalCurve, grid.level+1);
+	child.ix = 2*grid.ix + (quadrant & 1);
+	child.iy = 2*grid.iy + (quadrant >> 1);
+	return child;
+}
 
-	searchArea cRects[4];
-	cRects[0] = makeSearchArea(pArea.x, pArea.y, newSize);
-	cRects[1] = makeSearchArea(pArea.x+newSize, pArea.y, newSize);
-	cRects[2] = makeSearchArea(pArea.x, pArea.y+newSize, newSize);
-	cRects[3] = makeSearchArea(pArea.x+newSize, pArea.y+newSize, newSize);
+/*
+ * Split the area into quadrants and continue searching
+ */
+void divideAndConquer(searchGrid grid)
+{
+	// Children on the split level are handed to the parallel search as one task
+	if (grid.context->tasks != NULL && grid.level + 1 == grid.context->splitLevel)
+	{
+		deferSearch(grid.context->tasks, grid);
+		return;
+	}
 	
 	int i;
 	for (i=0; i < 4; i++)
-	{
-		search(makeSearchGrid(cRects[i], grid.source, grid.event, grid.checkLenses, grid.checkCriticalCurve, grid.level+1));
-	}
+		search(childGrid(grid, i));
 }
 
 /*
@@ -145,75 +353,306 @@ void divideAndConquer(searchGrid grid)
  */
 int jacobianSignAtPoint(point p, searchGrid grid)
 {
-	double dFxx = 1;
-	double dFyy = 1;
-	double dFxy = 0;
-	
-	int i;
-	for (i=0; i < grid.event->numLenses; i++)
+	double jacobian;
+	lensJacobians(grid.event, &p, &jacobian, 1);
+	return (jacobian > 0) ? 1 : -1;
+}
+
+/*
+ * Most segments each side of a cell is divided into: about one per resolution
+ * element, and a power of two so that the samples of a child edge are shared
+ * with its parent edge
+ */
+int boundaryPointsPerSide(double size, double resolution)
+{
+	int minPoints = MIN_EDGE_SEGMENTS;
+	int pointsPerSide = minPoints;
+	while (pointsPerSide < size/resolution && pointsPerSide < (1 << EDGE_DEPTH))
+		pointsPerSide *= 2;
+	return pointsPerSide;
+}
+
+/*
+ * Points waiting to be transformed into the source plane, with where to store them
+ */
+typedef struct pendingPoints {
+	point *image;
+	point **target;
+	int count;
+} pendingPoints;
+
+/*
+ * The samples of one edge of a cell, in order from its lattice start point
+ */
+typedef struct boundaryEdge {
+	point *samples;
+	uint32_t *offsets;
+	int numSamples;
+} boundaryEdge;
+
+/*
+ * Appends to offsets the end points of the segments that [from, to] is divided
+ * into, for the edge from start to end. A segment is split while the mapped
+ * segment may stray from the chord between its mapped ends by more than the
+ * tolerance (at most h^2/4 sum m_i/d_i^3 for a segment of length h),
+ * down to the finest spacing
+ */
+static void refineEdgeOffsets(event *event, point start, point end, uint32_t from, uint32_t to, uint32_t finest, double tolerance, uint32_t *offsets, int *count)
+{
+	if (to - from > finest)
 	{
-		dFxx += lensJacobianContribution(grid.event->lenses[i], p, 0);
-		dFxy += lensJacobianContribution(grid.event->lenses[i], p, 1);
-		dFyy += lensJacobianContribution(grid.event->lenses[i], p, 2);
+		double scale = 1.0/(1 << EDGE_DEPTH);
+		point a = makePoint(start.x + (end.x - start.x)*from*scale, start.y + (end.y - start.y)*from*scale);
+		point b = makePoint(start.x + (end.x - start.x)*to*scale, start.y + (end.y - start.y)*to*scale);
+		double h2 = (b.x - a.x)*(b.x - a.x) + (b.y - a.y)*(b.y - a.y);
+		if (h2/4*lensCurvatureBound(event, a, b, 4*tolerance/h2) > tolerance)
+		{
+			uint32_t mid = from + (to - from)/2;
+			refineEdgeOffsets(event, start, end, from, mid, finest, tolerance, offsets, count);
+			refineEdgeOffsets(event, start, end, mid, to, finest, tolerance, offsets, count);
+			return;
+		}
 	}
-	
-	double jacobian = dFxx*dFyy-dFxy*dFxy;
-	return (jacobian > 0) ? 1 : -1;
+	offsets[(*count)++] = to;
 }
 
 /*
- * Transforms the search area into the source plane and finds how it intersects the source
+ * Offset of sample k along an edge. Edges without a list of offsets are
+ * divided uniformly
  */
-intersectionType mapsToSource(searchGrid grid)
+static uint32_t sampleOffset(const uint32_t *offsets, int numSamples, int k)
 {
-	// Generate a list of points around the edge of the grid to be transformed
-	int minPoints = 10;
-	int pointsPerSide = ((int)(grid.searchArea.size/grid.event->resolution) > minPoints) ? (int)(grid.searchArea.size/grid.event->resolution) : minPoints;
-	int vC = pointsPerSide*4;
-	int curV = 0;
-	double du = grid.searchArea.size/pointsPerSide;
-	int i,j;
+	return (offsets != NULL) ? offsets[k] : (uint32_t)k*((1u << EDGE_DEPTH)/(numSamples - 1));
+}
 
+/*
+ * Finds the source plane positions of the samples along an edge of the grid,
+ * starting at the image plane point start. The edge is sampled more densely
+ * where the lens equation bends it; the samples depend only on the edge, so
+ * that both cells sharing it agree.
+ * Edges already mapped by a neighbouring cell are taken from the cache, and
+ * samples already mapped along the parent edge are reused; any other samples
+ * are added to pending. Returns FALSE if there is not enough scratch memory
+ */
+static boolean mapEdge(searchGrid grid, edgeDirection direction, uint64_t i, uint64_t j, point start, int maxSegments, boundaryEdge *edge, pendingPoints *pending)
+{
+	edgeCache *cache = grid.context->cache;
+	scratchArena *arena = grid.context->arena;
+	double size = grid.searchArea.size;
+	point end = makePoint(start.x + ((direction == HORIZONTAL_EDGE) ? size : 0), start.y + ((direction == VERTICAL_EDGE) ? size : 0));
+	int k;
 	
-	// Create an array of points around the edge of the search area
-	point v[vC];
-	
-	// left
-	for (i=0;i<pointsPerSide;i++)
-		v[curV++] = makePoint(grid.searchArea.x, grid.searchArea.y + i*du);
+	if (cache != NULL)
+	{
+		edge->samples = lookupEdge(cache, grid.level, direction, i, j, &edge->offsets, &edge->numSamples);
+		if (edge->samples != NULL)
+			return TRUE;
+	}
 	
-	// top
-	for (i=0;i<pointsPerSide;i++)
-		v[curV++] = makePoint(grid.searchArea.x + i*du, grid.searchArea.y + grid.searchArea.size);
+	// Usually a bound over the whole edge shows that the coarsest sampling is enough
+	double tolerance = BOUNDARY_TOLERANCE*grid.event->resolution;
+	double h2 = size*size/(MIN_EDGE_SEGMENTS*MIN_EDGE_SEGMENTS);
+	uint32_t *offsets = NULL;
+	int numSamples = MIN_EDGE_SEGMENTS + 1;
+	if (maxSegments > MIN_EDGE_SEGMENTS && h2/4*lensCurvatureBound(grid.event, start, end, 4*tolerance/h2) > tolerance)
+	{
+		uint32_t coarsest = (1 << EDGE_DEPTH)/MIN_EDGE_SEGMENTS;
+		offsets = arenaAlloc(arena, (maxSegments + 1)*sizeof(uint32_t));
+		if (offsets == NULL)
+			return FALSE;
+		
+		numSamples = 0;
+		offsets[numSamples++] = 0;
+		for (k=0; k < MIN_EDGE_SEGMENTS; k++)
+			refineEdgeOffsets(grid.event, start, end, k*coarsest, (k + 1)*coarsest, (1 << EDGE_DEPTH)/maxSegments,
+				tolerance, offsets, &numSamples);
+		
+		if (numSamples == MIN_EDGE_SEGMENTS + 1)
+			offsets = NULL;
+	}
 	
-	// right
-	for (i=0;i<pointsPerSide;i++)
-		v[curV++] = makePoint(grid.searchArea.x + grid.searchArea.size, grid.searchArea.y + grid.searchArea.size - i*du);
+	// The edge is half of an edge of the level above if it lies on that lattice
+	point *parent = NULL;
+	uint32_t *parentOffsets = NULL;
+	int numParentSamples = 0;
+	uint32_t half = 0;
+	edge->samples = NULL;
+	edge->offsets = NULL;
+	if (cache != NULL)
+	{
+		uint64_t across = (direction == VERTICAL_EDGE) ? i : j;
+		uint64_t along = (direction == VERTICAL_EDGE) ? j : i;
+		if (grid.level > 1 && across % 2 == 0)
+			parent = lookupEdge(cache, grid.level - 1, direction, i/2, j/2, &parentOffsets, &numParentSamples);
+		half = (uint32_t)(along % 2) << EDGE_DEPTH;
+		edge->samples = insertEdge(cache, grid.level, direction, i, j, numSamples, (offsets != NULL) ? &edge->offsets : NULL);
+	}
 	
-	// bottom
-	for (i=0;i<pointsPerSide;i++)
-		v[curV++] = makePoint(grid.searchArea.x + grid.searchArea.size - i*du, grid.searchArea.y);
+	if (edge->samples == NULL)
+	{
+		edge->samples = arenaAlloc(arena, numSamples*sizeof(point));
+		if (edge->samples == NULL)
+			return FALSE;
+		edge->offsets = offsets;
+	}
+	else if (offsets != NULL)
+		memcpy(edge->offsets, offsets, numSamples*sizeof(uint32_t));
+	edge->numSamples = numSamples;
 	
-	// Transform the points into the source plane
-	point vt[vC];
-	for(i=0;i<vC;i++) // for each point
+	// Both edges are sampled in order, so walk along the parent edge as we go
+	double dx = (end.x - start.x)/(1 << EDGE_DEPTH);
+	double dy = (end.y - start.y)/(1 << EDGE_DEPTH);
+	int p = 0;
+	for (k=0; k < numSamples; k++)
 	{
-		vt[i] = v[i];
+		uint32_t offset = sampleOffset(offsets, numSamples, k);
+		uint32_t parentOffset = (half + offset)/2;
+		while (p < numParentSamples && sampleOffset(parentOffsets, numParentSamples, p) < parentOffset)
+			p++;
 		
-		double dx, dy, lensDsq;
-		for (j=0; j < grid.event->numLenses; j++) // for each lens
+		if (offset % 2 == 0 && p < numParentSamples && sampleOffset(parentOffsets, numParentSamples, p) == parentOffset)
+			edge->samples[k] = parent[p];
+		else
 		{
-			lens l = grid.event->lenses[j];
-			dx = (v[i].x-l.origin.x);
-			dy = (v[i].y-l.origin.y);
-			lensDsq = dx*dx + dy*dy;
-			
-			vt[i].x -= l.mass*dx/lensDsq;
-			vt[i].y -= l.mass*dy/lensDsq;
+			pending->image[pending->count] = makePoint(start.x + offset*dx, start.y + offset*dy);
+			pending->target[pending->count++] = &edge->samples[k];
 		}
 	}
+	return TRUE;
+}
+
+/*
+ * Finds a box in the source plane that contains the image of the whole grid,
+ * given the image of its centre. Across the grid the deflection differs from
+ * its value at the centre by at most the Lipschitz bound times the distance
+ * to a corner, so the box is the centre's image widened by that much.
+ * The box is infinite if the grid contains a lens
+ */
+void boundImageAround(searchGrid grid, point centreImage, double *minU, double *minV, double *maxU, double *maxV)
+{
+	double half = grid.searchArea.size/2;
+	double lipschitz = deflectionLipschitzBound(grid.event, areaCorner(grid.searchArea, BOTTOM_LEFT), areaCorner(grid.searchArea, TOP_RIGHT));
+	double width = half + lipschitz*hypot(half, half);
+	*minU = centreImage.x - width;
+	*maxU = centreImage.x + width;
+	*minV = centreImage.y - width;
+	*maxV = centreImage.y + width;
+}
+
+/*
+ * Finds a box in the source plane that contains the image of the whole grid,
+ * without mapping its boundary
+ */
+void boundGridImage(searchGrid grid, double *minU, double *minV, double *maxU, double *maxV)
+{
+	double half = grid.searchArea.size/2;
+	point centre = makePoint(grid.searchArea.x + half, grid.searchArea.y + half);
+	point image;
+	deflectPoints(grid.event, &centre, &image, 1);
+	grid.context->deflections++;
+	boundImageAround(grid, image, minU, minV, maxU, maxV);
+}
+
+/*
+ * Returns TRUE if a box in the source plane is clear of the source disk
+ */
+boolean boxClearOfSource(double minU, double minV, double maxU, double maxV, source *source)
+{
+	double dx = fmax(minU - source->origin.x, fmax(0, source->origin.x - maxU));
+	double dy = fmax(minV - source->origin.y, fmax(0, source->origin.y - maxV));
+	return (hypot(dx, dy) > source->radius);
+}
+
+/*
+ * Transforms the boundary of the search area into the source plane.
+ * The polygon is allocated from the context arena, and stays valid until the
+ * caller releases it. Returns the number of vertices, or -1 if there is not
+ * enough scratch memory
+ */
+int mapBoundary(searchGrid grid, point **polygon)
+{
+	scratchArena *arena = grid.context->arena;
+	int maxSegments = boundaryPointsPerSide(grid.searchArea.size, grid.event->resolution);
+	int maxSamples = 4*(maxSegments + 1);
+	pendingPoints pending;
+	pending.image = arenaAlloc(arena, maxSamples*sizeof(point));
+	pending.target = arenaAlloc(arena, maxSamples*sizeof(point *));
+	pending.count = 0;
+	
+	// Allocated before any edge is added to the cache, since added edges must be filled in
+	point *mapped = arenaAlloc(arena, maxSamples*sizeof(point));
+	point *vt = arenaAlloc(arena, maxSamples*sizeof(point));
+	if (pending.image == NULL || pending.target == NULL || mapped == NULL || vt == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate cell boundary\n");
+		return -1;
+	}
+	
+	boundaryEdge left, top, right, bottom;
+	if (!mapEdge(grid, VERTICAL_EDGE, grid.ix, grid.iy, areaCorner(grid.searchArea, BOTTOM_LEFT), maxSegments, &left, &pending) ||
+		!mapEdge(grid, HORIZONTAL_EDGE, grid.ix, grid.iy + 1, areaCorner(grid.searchArea, TOP_LEFT), maxSegments, &top, &pending) ||
+		!mapEdge(grid, VERTICAL_EDGE, grid.ix + 1, grid.iy, areaCorner(grid.searchArea, BOTTOM_RIGHT), maxSegments, &right, &pending) ||
+		!mapEdge(grid, HORIZONTAL_EDGE, grid.ix, grid.iy, areaCorner(grid.searchArea, BOTTOM_LEFT), maxSegments, &bottom, &pending))
+	{
+		// An edge may fail after earlier ones were added to the cache unfilled
+		edgeCache *cache = grid.context->cache;
+		if (cache != NULL)
+		{
+			removeEdge(cache, grid.level, VERTICAL_EDGE, grid.ix, grid.iy);
+			removeEdge(cache, grid.level, HORIZONTAL_EDGE, grid.ix, grid.iy + 1);
+			removeEdge(cache, grid.level, VERTICAL_EDGE, grid.ix + 1, grid.iy);
+			removeEdge(cache, grid.level, HORIZONTAL_EDGE, grid.ix, grid.iy);
+		}
+		fprintf(stderr, "Error: cannot allocate cell boundary\n");
+		return -1;
+	}
+	
+	int i, vC = 0;
+	deflectPoints(grid.event, pending.image, mapped, pending.count);
+	grid.context->deflections += pending.count;
+	for (i=0;i<pending.count;i++)
+		*pending.target[i] = mapped[i];
+	
+	// Join the edges into a polygon: up the left, along the top, down the right, back along the bottom
+	for (i=0; i < left.numSamples - 1; i++)
+		vt[vC++] = left.samples[i];
+	for (i=0; i < top.numSamples - 1; i++)
+		vt[vC++] = top.samples[i];
+	for (i=right.numSamples - 1; i > 0; i--)
+		vt[vC++] = right.samples[i];
+	for (i=bottom.numSamples - 1; i > 0; i--)
+		vt[vC++] = bottom.samples[i];
+	
+	*polygon = vt;
+	return vC;
+}
+
+/*
+ * Finds how the image of the grid intersects the source, without mapping the
+ * boundary of cells whose image is bounded away from it
+ */
+intersectionType mapsToSource(searchGrid grid)
+{
+	// Most cells are far from the source, and a bound on their image shows it cheaply
+	double minU, minV, maxU, maxV;
+	boundGridImage(grid, &minU, &minV, &maxU, &maxV);
+	if (boxClearOfSource(minU, minV, maxU, maxV, grid.source))
+		return NO_OVERLAP;
+	return boundaryMapsToSource(grid);
+}
+
+/*
+ * Transforms the search area into the source plane and finds how it intersects the source
+ */
+intersectionType boundaryMapsToSource(searchGrid grid)
+{
+	arenaMark mark = arenaGetMark(grid.context->arena);
+	point *vt;
+	int vC = mapBoundary(grid, &vt);
 	
-	intersectionType hit = testPolygonAgainstSource(vt, vC, grid.source); // Test transformed area against source
+	// Without a boundary the cell is assumed to overlap, so that it is divided
+	intersectionType hit = (vC > 0) ? testPolygonAgainstSource(vt, vC, grid.source) : OVERLAP; // Test transformed area against source
 	
+	arenaRelease(grid.context->arena, mark);
 	return hit;
 }
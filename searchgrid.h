@@ -30,8 +30,28 @@
 #define SEARCHGRID_HEADER
 
 // Function declarations
+void initSearchContext(searchContext *context, boolean recordCells);
+void resetSearchContext(searchContext *context);
+void freeSearchContext(searchContext *context);
+void beginSearch(searchArea a, event *event, searchContext *context);
+void endSearch(searchContext *context);
+void addLeafCell(searchGrid grid, intersectionType hit);
+searchArea imageCellArea(searchArea root, imageCell cell);
+void mergeSearchCounters(searchContext *into, const searchContext *from);
+void mergeSearchContext(searchContext *into, const searchContext *from);
+double searchImages(searchArea a, source *source, event *event, searchContext *context);
 void search(searchGrid grid);
 void divideAndConquer(searchGrid grid);
+boolean gridAtResolution(searchGrid grid);
+searchGrid childGrid(searchGrid grid, int quadrant);
+boolean containsLens(searchGrid grid);
+boolean straddlesCriticalCurve(searchGrid grid);
 int jacobianSignAtPoint(point p, searchGrid grid);
+int boundaryPointsPerSide(double size, double resolution);
+int mapBoundary(searchGrid grid, point **polygon);
+void boundImageAround(searchGrid grid, point centreImage, double *minU, double *minV, double *maxU, double *maxV);
+void boundGridImage(searchGrid grid, double *minU, double *minV, double *maxU, double *maxV);
+boolean boxClearOfSource(double minU, double minV, double maxU, double maxV, source *source);
 intersectionType mapsToSource(searchGrid grid);
+intersectionType boundaryMapsToSource(searchGrid grid);
 #endif
@@ -0,0 +1,354 @@
+/*
+ * searchstats.c
+ * Per frame and per level statistics of image searches.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "typedefs.h"
+#include "searchstats.h"
+
+// Names of the cell statistics in the exported files
+static const char *statNames[NUM_CELL_STATS] = {"visited", "lens", "criticalCurve", "noOverlap", "insideSource", "atResolution"};
+
+/*
+ * Seconds on the monotonic clock
+ */
+static double monotonicSeconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+/*
+ * Creates an empty set of statistics. Set context.stats to it to collect the
+ * statistics of each search made with that context.
+ * Returns NULL if it cannot be allocated
+ */
+searchStats *newSearchStats(void)
+{
+	searchStats *stats = calloc(1, sizeof(searchStats));
+	if (stats == NULL)
+		return NULL;
+	stats->origin = monotonicSeconds();
+	return stats;
+}
+
+/*
+ * Releases a set of statistics
+ */
+void freeSearchStats(searchStats *stats)
+{
+	if (stats == NULL)
+		return;
+	free(stats->frames);
+	free(stats->spans);
+	free(stats);
+}
+
+/*
+ * Adds a span to the trace, if there is room
+ */
+static void addSpan(searchStats *stats, const char *name, int thread, double start, double seconds)
+{
+	if (stats->numSpans == stats->maxSpans)
+	{
+		int newMax = (stats->maxSpans > 0) ? 2*stats->maxSpans : 64;
+		traceSpan *spans = realloc(stats->spans, newMax*sizeof(traceSpan));
+		if (spans == NULL)
+			return;
+		stats->spans = spans;
+		stats->maxSpans = newMax;
+	}
+	traceSpan *s = &stats->spans[stats->numSpans++];
+	s->name = name;
+	s->thread = thread;
+	s->frame = stats->numFrames - 1;
+	s->start = start;
+	s->seconds = seconds;
+}
+
+/*
+ * Charges the time and deflections since the last cell visit to its level
+ */
+static void chargeWork(searchStats *stats, const searchContext *context)
+{
+	double now = monotonicSeconds();
+	levelStats *level = &stats->frames[stats->numFrames - 1].levels[stats->lastLevel];
+	level->seconds += now - stats->lastTime;
+	if (stats->lastContext != NULL)
+		level->deflections += stats->lastContext->deflections - stats->lastDeflections;
+	
+	stats->lastTime = now;
+	stats->lastContext = context;
+	stats->lastDeflections = (context != NULL) ? context->deflections : 0;
+}
+
+/*
+ * Starts the statistics of a new search with the given (cleared) context.
+ * Called by beginSearch()
+ */
+void beginStatsFrame(searchStats *stats, const searchContext *context)
+{
+	if (stats->numFrames == stats->maxFrames)
+	{
+		int newMax = (stats->maxFrames > 0) ? 2*stats->maxFrames : 16;
+		frameStats *frames = realloc(stats->frames, newMax*sizeof(frameStats));
+		if (frames == NULL)
+		{
+			fprintf(stderr, "Error: cannot allocate search statistics\n");
+			stats->active = FALSE;
+			return;
+		}
+		stats->frames = frames;
+		stats->maxFrames = newMax;
+	}
+	
+	frameStats *frame = &stats->frames[stats->numFrames++];
+	memset(frame, 0, sizeof(frameStats));
+	stats->lastTime = monotonicSeconds();
+	frame->start = stats->lastTime - stats->origin;
+	stats->lastLevel = 0;
+	stats->lastContext = context;
+	stats->lastDeflections = (context != NULL) ? context->deflections : 0;
+	stats->active = TRUE;
+}
+
+/*
+ * Finishes the statistics of the current search, taking its totals from the
+ * context. Called by endSearch()
+ */
+void endStatsFrame(searchStats *stats, const searchContext *context)
+{
+	if (!stats->active)
+		return;
+	chargeWork(stats, context);
+	
+	frameStats *frame = &stats->frames[stats->numFrames - 1];
+	frame->seconds = stats->lastTime - stats->origin - frame->start;
+	if (context != NULL)
+	{
+		frame->imageArea = context->imageArea;
+		frame->deflections = context->deflections;
+		addSpan(stats, "search", 0, frame->start, frame->seconds);
+	}
+	stats->active = FALSE;
+}
+
+/*
+ * Counts cells of a level. Visits also mark the start of work on that level
+ */
+void countLevelCells(searchContext *context, int level, cellStat stat, long count)
+{
+	searchStats *stats = context->stats;
+	if (stats == NULL || !stats->active)
+		return;
+	
+	if (stat == STAT_VISITED)
+	{
+		chargeWork(stats, context);
+		stats->lastLevel = level;
+	}
+	stats->frames[stats->numFrames - 1].levels[level].cells[stat] += count;
+}
+
+/*
+ * Counts one cell of a grid's level
+ */
+void countCell(searchGrid grid, cellStat stat)
+{
+	if (grid.context->stats != NULL)
+		countLevelCells(grid.context, grid.level, stat, 1);
+}
+
+/*
+ * Charges the work since the last cell visit before the context is set aside
+ * (at the end of each parallel search task)
+ */
+void flushCellStats(searchContext *context)
+{
+	searchStats *stats = context->stats;
+	if (stats == NULL || !stats->active)
+		return;
+	chargeWork(stats, context);
+	stats->lastContext = NULL;
+}
+
+/*
+ * Adds the counts of a worker thread's (finished) frame to the current frame,
+ * and its running time to the trace
+ */
+void mergeWorkerStats(searchStats *stats, searchStats *worker, int thread)
+{
+	if (!stats->active || worker->numFrames == 0)
+		return;
+	
+	frameStats *into = &stats->frames[stats->numFrames - 1];
+	frameStats *from = &worker->frames[worker->numFrames - 1];
+	int i, k;
+	for (i=0; i < MAX_SEARCH_LEVELS; i++)
+	{
+		for (k=0; k < NUM_CELL_STATS; k++)
+			into->levels[i].cells[k] += from->levels[i].cells[k];
+		into->levels[i].deflections += from->levels[i].deflections;
+		into->levels[i].seconds += from->levels[i].seconds;
+	}
+	addSpan(stats, "worker", thread, from->start + worker->origin - stats->origin, from->seconds);
+}
+
+/*
+ * Returns TRUE if anything happened on a level
+ */
+static boolean levelUsed(const levelStats *l)
+{
+	int k;
+	for (k=0; k < NUM_CELL_STATS; k++)
+		if (l->cells[k] != 0)
+			return TRUE;
+	return l->deflections != 0 || l->seconds > 0;
+}
+
+/*
+ * Writes the statistics of every frame and level as JSON
+ */
+boolean writeStatsJSON(searchStats *stats, const char *filename)
+{
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	int f, i, k;
+	fprintf(out, "{\"frames\": [");
+	for (f=0; f < stats->numFrames; f++)
+	{
+		frameStats *frame = &stats->frames[f];
+		fprintf(out, "%s\n  {\"frame\": %d, \"start\": %.9f, \"seconds\": %.9f, \"deflections\": %ld, \"imageArea\": %.12g, \"levels\": [",
+			(f > 0) ? "," : "", f, frame->start, frame->seconds, frame->deflections, frame->imageArea);
+		
+		boolean first = TRUE;
+		for (i=0; i < MAX_SEARCH_LEVELS; i++)
+		{
+			levelStats *l = &frame->levels[i];
+			if (!levelUsed(l))
+				continue;
+			fprintf(out, "%s\n    {\"level\": %d", first ? "" : ",", i);
+			for (k=0; k < NUM_CELL_STATS; k++)
+				fprintf(out, ", \"%s\": %ld", statNames[k], l->cells[k]);
+			fprintf(out, ", \"deflections\": %ld, \"seconds\": %.9f}", l->deflections, l->seconds);
+			first = FALSE;
+		}
+		fprintf(out, "]}");
+	}
+	fprintf(out, "\n]}\n");
+	return fclose(out) == 0;
+}
+
+/*
+ * Writes the statistics as CSV, one line per frame and level
+ */
+boolean writeStatsCSV(searchStats *stats, const char *filename)
+{
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	int f, i, k;
+	fprintf(out, "frame,frameSeconds,level");
+	for (k=0; k < NUM_CELL_STATS; k++)
+		fprintf(out, ",%s", statNames[k]);
+	fprintf(out, ",deflections,seconds\n");
+	
+	for (f=0; f < stats->numFrames; f++)
+	{
+		frameStats *frame = &stats->frames[f];
+		for (i=0; i < MAX_SEARCH_LEVELS; i++)
+		{
+			levelStats *l = &frame->levels[i];
+			if (!levelUsed(l))
+				continue;
+			fprintf(out, "%d,%.9f,%d", f, frame->seconds, i);
+			for (k=0; k < NUM_CELL_STATS; k++)
+				fprintf(out, ",%ld", l->cells[k]);
+			fprintf(out, ",%ld,%.9f\n", l->deflections, l->seconds);
+		}
+	}
+	return fclose(out) == 0;
+}
+
+/*
+ * Writes a trace for chrome://tracing (or Perfetto): a span for each search
+ * and for each worker thread's share of it, and the cells visited per level
+ * as a counter
+ */
+boolean writeChromeTrace(searchStats *stats, const char *filename)
+{
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error: cannot open %s\n", filename);
+		return FALSE;
+	}
+	
+	int i, f;
+	boolean first = TRUE;
+	fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (i=0; i < stats->numSpans; i++)
+	{
+		traceSpan *s = &stats->spans[i];
+		frameStats *frame = &stats->frames[s->frame];
+		fprintf(out, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d, \"deflections\": %ld}}",
+			first ? "" : ",", s->name, s->thread, 1e6*s->start, 1e6*s->seconds, s->frame, frame->deflections);
+		first = FALSE;
+	}
+	
+	for (f=0; f < stats->numFrames; f++)
+	{
+		frameStats *frame = &stats->frames[f];
+		fprintf(out, "%s\n  {\"name\": \"cells visited\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {", first ? "" : ",", 1e6*frame->start);
+		boolean firstLevel = TRUE;
+		for (i=1; i < MAX_SEARCH_LEVELS; i++)
+		{
+			if (frame->levels[i].cells[STAT_VISITED] == 0)
+				continue;
+			fprintf(out, "%s\"level %02d\": %ld", firstLevel ? "" : ", ", i, frame->levels[i].cells[STAT_VISITED]);
+			firstLevel = FALSE;
+		}
+		fprintf(out, "}}");
+		first = FALSE;
+	}
+	fprintf(out, "\n]}\n");
+	return fclose(out) == 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * searchstats.h
+ * Per frame and per level statistics of image searches.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef SEARCHSTATS_HEADER
+#define SEARCHSTATS_HEADER
+
+/*
+ * What happened to the cells of a level. STAT_VISITED counts every cell
+ * examined; the others count cells set aside by each test
+ */
+typedef enum cellStat {
+	STAT_VISITED = 0,
+	STAT_LENS = 1,				// Contains a lens
+	STAT_CRITICAL_CURVE = 2,	// Straddles a critical curve
+	STAT_NO_OVERLAP = 3,
+	STAT_INSIDE_SOURCE = 4,
+	STAT_AT_RESOLUTION = 5,		// Left undivided on the edge of the image
+	NUM_CELL_STATS = 6
+} cellStat;
+
+typedef struct levelStats {
+	long cells[NUM_CELL_STATS];
+	long deflections;
+	double seconds;
+} levelStats;
+
+/*
+ * One search. Work between cell visits is charged to the level of the last
+ * cell visited (level 0 for work outside the cells), summed over threads
+ */
+typedef struct frameStats {
+	double start;
+	double seconds;
+	double imageArea;
+	long deflections;
+	levelStats levels[MAX_SEARCH_LEVELS];
+} frameStats;
+
+/*
+ * A span of time on one thread, for the Chrome trace
+ */
+typedef struct traceSpan {
+	const char *name;
+	int thread;
+	int frame;
+	double start;
+	double seconds;
+} traceSpan;
+
+typedef struct searchStats {
+	frameStats *frames;
+	int numFrames;
+	int maxFrames;
+	traceSpan *spans;
+	int numSpans;
+	int maxSpans;
+	boolean active;
+	
+	// Monotonic clock time that the times above are measured from
+	double origin;
+	
+	// The last cell visit, which the work since is charged to
+	double lastTime;
+	int lastLevel;
+	const searchContext *lastContext;
+	long lastDeflections;
+} searchStats;
+
+// Function declarations
+searchStats *newSearchStats(void);
+void freeSearchStats(searchStats *stats);
+void beginStatsFrame(searchStats *stats, const searchContext *context);
+void endStatsFrame(searchStats *stats, const searchContext *context);
+void countLevelCells(searchContext *context, int level, cellStat stat, long count);
+void countCell(searchGrid grid, cellStat stat);
+void flushCellStats(searchContext *context);
+void mergeWorkerStats(searchStats *stats, searchStats *worker, int thread);
+boolean writeStatsJSON(searchStats *stats, const char *filename);
+boolean writeStatsCSV(searchStats *stats, const char *filename);
+boolean writeChromeTrace(searchStats *stats, const char *filename);
+#endif
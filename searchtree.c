@@ -0,0 +1,376 @@
+/*
+ * searchtree.c
+ * Quadtree kept between frames for incremental image searches.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "searchtree.h"
+#include "arena.h"
+#include "searchstats.h"
+
+/*
+ * Prepares an empty tree
+ */
+void initSearchTree(searchTree *tree)
+{
+	memset(tree, 0, sizeof(searchTree));
+}
+
+/*
+ * Releases the nodes of a tree, leaving it empty
+ */
+static void clearSearchTree(searchTree *tree)
+{
+	int i;
+	for (i=0; i < tree->numNodes; i++)
+		free(tree->nodes[i].polygon);
+	tree->numNodes = 0;
+	tree->numFreeBlocks = 0;
+}
+
+/*
+ * Releases the memory owned by a tree
+ */
+void freeSearchTree(searchTree *tree)
+{
+	clearSearchTree(tree);
+	free(tree->nodes);
+	free(tree->freeBlocks);
+	free(tree->lenses);
+	initSearchTree(tree);
+}
+
+/*
+ * Empties the tree unless it was built for the same lenses, root area, resolution
+ * and opening angle.
+ * Returns FALSE if there is not enough memory
+ */
+static boolean validateSearchTree(searchTree *tree, searchArea a, event *e)
+{
+	if (tree->numNodes > 0 && tree->numLenses == e->numLenses && tree->resolution == e->resolution &&
+		tree->openingAngle == e->openingAngle &&
+		tree->root.x == a.x && tree->root.y == a.y && tree->root.size == a.size &&
+		(e->numLenses == 0 || memcmp(tree->lenses, e->lenses, e->numLenses*sizeof(lens)) == 0))
+		return TRUE;
+	
+	clearSearchTree(tree);
+	free(tree->lenses);
+	tree->lenses = malloc(e->numLenses*sizeof(lens));
+	if (tree->nodes == NULL)
+	{
+		tree->nodes = malloc(256*sizeof(treeNode));
+		tree->maxNodes = (tree->nodes != NULL) ? 256 : 0;
+	}
+	if (tree->nodes == NULL || (e->numLenses > 0 && tree->lenses == NULL))
+	{
+		fprintf(stderr, "Error: cannot allocate search tree\n");
+		tree->numLenses = -1;
+		return FALSE;
+	}
+	
+	memcpy(tree->lenses, e->lenses, e->numLenses*sizeof(lens));
+	tree->numLenses = e->numLenses;
+	tree->resolution = e->resolution;
+	tree->openingAngle = e->openingAngle;
+	tree->root = a;
+	
+	memset(&tree->nodes[0], 0, sizeof(treeNode));
+	tree->nodes[0].children = -1;
+	tree->numNodes = 1;
+	return TRUE;
+}
+
+/*
+ * Returns the index of a block of four new nodes, or -1 if there is no memory
+ */
+static int allocChildren(searchTree *tree)
+{
+	int first;
+	if (tree->numFreeBlocks > 0)
+		first = tree->freeBlocks[--tree->numFreeBlocks];
+	else
+	{
+		if (tree->numNodes + 4 > tree->maxNodes)
+		{
+			int newMax = 2*tree->maxNodes;
+			treeNode *nodes = realloc(tree->nodes, newMax*sizeof(treeNode));
+			if (nodes == NULL)
+				return -1;
+			tree->nodes = nodes;
+			tree->maxNodes = newMax;
+		}
+		first = tree->numNodes;
+		tree->numNodes += 4;
+	}
+	
+	int i;
+	memset(&tree->nodes[first], 0, 4*sizeof(treeNode));
+	for (i=0; i < 4; i++)
+		tree->nodes[first + i].children = -1;
+	return first;
+}
+
+/*
+ * Removes the subtree below a node
+ */
+static void pruneChildren(searchTree *tree, int n)
+{
+	int first = tree->nodes[n].children;
+	if (first < 0)
+		return;
+	
+	int i;
+	for (i=0; i < 4; i++)
+	{
+		pruneChildren(tree, first + i);
+		free(tree->nodes[first + i].polygon);
+		tree->nodes[first + i].polygon = NULL;
+	}
+	tree->nodes[n].children = -1;
+	
+	if (tree->numFreeBlocks == tree->maxFreeBlocks)
+	{
+		int newMax = (tree->maxFreeBlocks > 0) ? 2*tree->maxFreeBlocks : 256;
+		int *blocks = realloc(tree->freeBlocks, newMax*sizeof(int));
+		if (blocks == NULL)
+			return; // The block is leaked until the tree is cleared
+		tree->freeBlocks = blocks;
+		tree->maxFreeBlocks = newMax;
+	}
+	tree->freeBlocks[tree->numFreeBlocks++] = first;
+}
+
+/*
+ * Decides whether a new node contains a lens or straddles a critical curve, as search() does
+ */
+static void evaluateNode(treeNode *node, searchGrid grid)
+{
+	boolean atResolution = gridAtResolution(grid);
+	
+	if (grid.checkLenses)
+	{
+		if (containsLens(grid))
+		{
+			node->kind = atResolution ? NODE_UNRESOLVED : NODE_SPLIT;
+			node->checkLenses = TRUE;
+			node->checkCriticalCurve = grid.checkCriticalCurve;
+			return;
+		}
+		grid.checkLenses = FALSE;
+	}
+	
+	if (grid.checkCriticalCurve)
+	{
+		if (straddlesCriticalCurve(grid))
+		{
+			node->kind = atResolution ? NODE_UNRESOLVED : NODE_SPLIT;
+			node->checkLenses = FALSE;
+			node->checkCriticalCurve = TRUE;
+			return;
+		}
+		grid.checkCriticalCurve = FALSE;
+	}
+	
+	node->kind = NODE_MAPPED;
+	node->checkLenses = FALSE;
+	node->checkCriticalCurve = FALSE;
+	node->mapped = FALSE;
+	node->bounded = FALSE;
+}
+
+/*
+ * Finds how the mapped boundary of a node intersects the source.
+ * The bounding box of the boundary settles cells well inside or outside the
+ * source; only the others are tested against the source (and mapped if needed).
+ * Before a node is mapped, a looser bound on its image can still show that it
+ * is outside the source.
+ */
+static intersectionType classifyNode(searchTree *tree, treeNode *node, searchGrid grid)
+{
+	source *s = grid.source;
+	if (!node->mapped && !node->bounded)
+	{
+		boundGridImage(grid, &node->minU, &node->minV, &node->maxU, &node->maxV);
+		node->bounded = TRUE;
+	}
+	
+	if (boxClearOfSource(node->minU, node->minV, node->maxU, node->maxV, s))
+	{
+		free(node->polygon);
+		node->polygon = NULL;
+		node->hit = NO_OVERLAP;
+		return node->hit;
+	}
+	
+	if (node->mapped)
+	{
+		// Furthest point of the box from the source centre
+		double fx = fmax(fabs(node->minU - s->origin.x), fabs(node->maxU - s->origin.x));
+		double fy = fmax(fabs(node->minV - s->origin.y), fabs(node->maxV - s->origin.y));
+		
+		if (hypot(fx, fy) <= s->radius)
+		{
+			free(node->polygon);
+			node->polygon = NULL;
+			node->hit = INSIDE_SOURCE;
+			return node->hit;
+		}
+	}
+	
+	arenaMark mark = arenaGetMark(grid.context->arena);
+	point *vt = node->polygon;
+	int vC = node->numVertices;
+	if (vt == NULL)
+	{
+		vC = mapBoundary(grid, &vt);
+		if (vC <= 0)
+		{
+			// Without a boundary the cell is assumed to overlap, so that it is divided
+			arenaRelease(grid.context->arena, mark);
+			node->hit = OVERLAP;
+			return node->hit;
+		}
+		
+		int i;
+		node->minU = node->maxU = vt[0].x;
+		node->minV = node->maxV = vt[0].y;
+		for (i=1; i < vC; i++)
+		{
+			node->minU = fmin(node->minU, vt[i].x);
+			node->maxU = fmax(node->maxU, vt[i].x);
+			node->minV = fmin(node->minV, vt[i].y);
+			node->maxV = fmax(node->maxV, vt[i].y);
+		}
+		node->mapped = TRUE;
+		
+		// Keep the boundary if we can, since cells near the source edge are tested every frame
+		node->polygon = malloc(vC*sizeof(point));
+		if (node->polygon != NULL)
+		{
+			memcpy(node->polygon, vt, vC*sizeof(point));
+			node->numVertices = vC;
+		}
+	}
+	
+	node->hit = testPolygonAgainstSource(vt, vC, s);
+	grid.context->calculations[grid.level] += 40;
+	tree->retested++;
+	arenaRelease(grid.context->arena, mark);
+	
+	if (node->hit == NO_OVERLAP || node->hit == INSIDE_SOURCE)
+	{
+		free(node->polygon);
+		node->polygon = NULL;
+	}
+	return node->hit;
+}
+
+static void updateNode(searchTree *tree, int n, searchGrid grid);
+
+/*
+ * Continues the search into the children of a node, creating them if needed
+ */
+static void descend(searchTree *tree, int n, searchGrid grid)
+{
+	if (tree->nodes[n].children < 0)
+	{
+		int first = allocChildren(tree);
+		if (first < 0)
+		{
+			// Out of memory: finish this subtree without keeping it
+			fprintf(stderr, "Error: cannot allocate search tree nodes\n");
+			divideAndConquer(grid);
+			return;
+		}
+		tree->nodes[n].children = first;
+	}
+	
+	// Children are updated by index, since allocating nodes may move the node array
+	int first = tree->nodes[n].children;
+	grid.checkLenses = tree->nodes[n].checkLenses;
+	grid.checkCriticalCurve = tree->nodes[n].checkCriticalCurve;
+	
+	int i;
+	for (i=0; i < 4; i++)
+		updateNode(tree, first + i, childGrid(grid, i));
+}
+
+/*
+ * Brings a node up to date with the current source, with the same result as search()
+ */
+static void updateNode(searchTree *tree, int n, searchGrid grid)
+{
+	treeNode *node = &tree->nodes[n];
+	if (node->kind == NODE_NEW)
+		evaluateNode(node, grid);
+	countCell(grid, STAT_VISITED);
+	
+	switch (node->kind)
+	{
+		case NODE_SPLIT:
+			countCell(grid, node->checkLenses ? STAT_LENS : STAT_CRITICAL_CURVE);
+			descend(tree, n, grid);
+			return;
+		case NODE_MAPPED:
+			break;
+		default:
+			countCell(grid, node->checkLenses ? STAT_LENS : STAT_CRITICAL_CURVE);
+			return;
+	}
+	
+	intersectionType hit = classifyNode(tree, node, grid);
+	if (hit == NO_OVERLAP || hit == INSIDE_SOURCE || gridAtResolution(grid))
+	{
+		pruneChildren(tree, n);
+		addLeafCell(grid, hit);
+		return;
+	}
+	descend(tree, n, grid);
+}
+
+/*
+ * Finds the images of a source inside a given area, reusing the tree from
+ * the previous call. Gives the same results as searchImages(), but only
+ * re-examines the cells whose images could have changed since the last
+ * source position. The tree is rebuilt if the lenses, area or resolution change.
+ */
+double searchImagesIncremental(searchArea a, source *source, event *event, searchContext *context, searchTree *tree)
+{
+	if (!validateSearchTree(tree, a, event))
+		return searchImages(a, source, event, context);
+	
+	beginSearch(a, event, context);
+	tree->retested = 0;
+	updateNode(tree, 0, makeSearchGrid(a, source, event, context, TRUE, TRUE, 1));
+	endSearch(context);
+	return context->imageArea;
+}
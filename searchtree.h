@@ -0,0 +1,88 @@
+/*
+ * searchtree.h
+ * Quadtree kept between frames for incremental image searches.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SEARCHTREE_HEADER
+#define SEARCHTREE_HEADER
+
+typedef enum nodeKind {
+	NODE_NEW = 0,			// Not evaluated yet
+	NODE_SPLIT = 1,			// Divided because it contains a lens or straddles a critical curve
+	NODE_UNRESOLVED = 2,	// Contains a lens or critical curve at the search resolution
+	NODE_MAPPED = 3			// Boundary mapped into the source plane
+} nodeKind;
+
+/*
+ * A cell of the search tree.
+ * Whether a cell contains a lens or straddles a critical curve does not depend
+ * on the source, so that part of the tree never changes. Mapped cells keep the
+ * source plane bounding box of their boundary, which proves most of them
+ * unchanged when the source moves; the mapped boundary itself is kept only for
+ * cells that straddle the source edge, where it is needed again. Cells not yet
+ * mapped keep a looser bound on their image (bounded) in the same box.
+ */
+typedef struct treeNode {
+	nodeKind kind;
+	intersectionType hit;
+	boolean checkLenses;
+	boolean checkCriticalCurve;
+	boolean mapped;
+	boolean bounded;
+	int children;
+	double minU;
+	double maxU;
+	double minV;
+	double maxV;
+	point *polygon;
+	int numVertices;
+} treeNode;
+
+typedef struct searchTree {
+	treeNode *nodes;
+	int numNodes;
+	int maxNodes;
+	int *freeBlocks;
+	int numFreeBlocks;
+	int maxFreeBlocks;
+	
+	// Number of cells tested against the source in the last search
+	long retested;
+	
+	// The configuration the tree was built for
+	searchArea root;
+	double resolution;
+	double openingAngle;
+	int numLenses;
+	lens *lenses;
+} searchTree;
+
+// Function declarations
+void initSearchTree(searchTree *tree);
+void freeSearchTree(searchTree *tree);
+double searchImagesIncremental(searchArea a, source *source, event *event, searchContext *context, searchTree *tree);
+#endif
@@ -0,0 +1,208 @@
+/*
+ * seededsearch.c
+ * Image search restricted to boxes grown around predicted image positions.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "seededsearch.h"
+#include "pointsource.h"
+
+// Number of points around the source limb used to seed the search
+#define LIMB_SEEDS 8
+
+/*
+ * Applies the divergence checks that search() makes before dividing a grid,
+ * so that its children carry the same flags as in a full search
+ */
+static searchGrid checkedGrid(searchGrid grid)
+{
+	if (grid.checkLenses)
+	{
+		if (containsLens(grid))
+			return grid;
+		grid.checkLenses = FALSE;
+	}
+	
+	if (grid.checkCriticalCurve && !straddlesCriticalCurve(grid))
+		grid.checkCriticalCurve = FALSE;
+	return grid;
+}
+
+/*
+ * Returns the lattice cell (level, ix, iy) below root, as it is reached by a full search
+ */
+static searchGrid latticeGrid(searchGrid root, int level, uint64_t ix, uint64_t iy)
+{
+	searchGrid grid = root;
+	while (grid.level < level)
+	{
+		int shift = level - grid.level - 1;
+		int quadrant = (int)((ix >> shift) & 1) + 2*(int)((iy >> shift) & 1);
+		grid = childGrid(checkedGrid(grid), quadrant);
+	}
+	return grid;
+}
+
+/*
+ * Returns the smallest cell no smaller than the source that contains the seed
+ */
+static searchGrid seedGrid(searchGrid root, point seed)
+{
+	searchGrid grid = root;
+	while (!gridAtResolution(grid) && grid.searchArea.size/2 >= 2*grid.source->radius)
+	{
+		double half = grid.searchArea.size/2;
+		int quadrant = (seed.x >= grid.searchArea.x + half) + 2*(seed.y >= grid.searchArea.y + half);
+		grid = childGrid(checkedGrid(grid), quadrant);
+	}
+	return grid;
+}
+
+/*
+ * Returns TRUE if the boundary of the grid maps clear of the source, so
+ * that every image either lies entirely inside the grid or entirely outside it
+ */
+static boolean boundaryClearOfSource(searchGrid grid)
+{
+	intersectionType hit = mapsToSource(grid);
+	grid.context->calculations[grid.level] += 40;
+	return (hit == NO_OVERLAP || hit == ENCLOSES_SOURCE);
+}
+
+/*
+ * Returns TRUE if lattice cell a contains lattice cell b
+ */
+static boolean gridContains(searchGrid a, searchGrid b)
+{
+	if (a.level > b.level)
+		return FALSE;
+	int shift = b.level - a.level;
+	return ((b.ix >> shift) == a.ix && (b.iy >> shift) == a.iy);
+}
+
+/*
+ * Finds the images of a source that lie near the seed positions.
+ * A box is placed around each seed and grown (to its parent cell) until its
+ * boundary maps clear of the source; only these boxes are then searched.
+ * Images without a seed nearby are missed. Without seeds (numSeeds <= 0, as
+ * when pointSourceSeeds() fails) the whole area is searched. Results are
+ * accumulated into a cleared context; returns the total image area
+ */
+double searchImagesSeeded(searchArea a, source *source, event *event, searchContext *context, const point *seeds, int numSeeds)
+{
+	if (numSeeds <= 0)
+		return searchImages(a, source, event, context);
+	
+	searchGrid *boxes = malloc(numSeeds*sizeof(searchGrid));
+	if (boxes == NULL && numSeeds > 0)
+	{
+		fprintf(stderr, "Error: cannot allocate seed boxes; searching the whole area\n");
+		return searchImages(a, source, event, context);
+	}
+	
+	beginSearch(a, event, context);
+	searchGrid root = makeSearchGrid(a, source, event, context, TRUE, TRUE, 1);
+	
+	int numBoxes = 0;
+	int i, j;
+	for (i=0; i < numSeeds; i++)
+	{
+		if (!pointInArea(seeds[i], a))
+			continue;
+		
+		// Seeds belonging to the same image usually end up in the same box
+		boolean covered = FALSE;
+		for (j=0; j < numBoxes && !covered; j++)
+			covered = pointInArea(seeds[i], boxes[j].searchArea);
+		if (covered)
+			continue;
+		
+		searchGrid box = seedGrid(root, seeds[i]);
+		while (box.level > 1 && !boundaryClearOfSource(box))
+			box = latticeGrid(root, box.level - 1, box.ix >> 1, box.iy >> 1);
+		boxes[numBoxes++] = box;
+	}
+	
+	// Boxes are lattice cells, so they are either nested or disjoint
+	for (i=0; i < numBoxes; i++)
+	{
+		boolean nested = FALSE;
+		for (j=0; j < numBoxes && !nested; j++)
+			nested = (j != i && gridContains(boxes[j], boxes[i]) && (boxes[j].level < boxes[i].level || j < i));
+		if (!nested)
+			search(boxes[i]);
+	}
+	
+	free(boxes);
+	endSearch(context);
+	return context->imageArea;
+}
+
+/*
+ * Predicts image positions for a seeded search from the point source images
+ * of the source centre and of points around its limb.
+ * Returns the number of seeds written, or -1 if the images of any point could
+ * not all be found (see pointSourceImages()) or do not fit in maxSeeds, since
+ * a search from the remaining seeds could miss images
+ */
+int pointSourceSeeds(event *event, source *source, point *seeds, int maxSeeds)
+{
+	int maxImages = maxPointImages(event);
+	pointImage *images = malloc(maxImages*sizeof(pointImage));
+	if (images == NULL)
+	{
+		fprintf(stderr, "Error: cannot allocate point source images\n");
+		return -1;
+	}
+	
+	int numSeeds = 0;
+	int i, j;
+	for (i=0; i <= LIMB_SEEDS; i++)
+	{
+		point p = source->origin;
+		if (i > 0)
+		{
+			double angle = 2*PI*(i - 1)/LIMB_SEEDS;
+			p = makePoint(p.x + source->radius*cos(angle), p.y + source->radius*sin(angle));
+		}
+		
+		int numImages = pointSourceImages(event, p, images, maxImages);
+		if (numImages < 0 || numSeeds + numImages > maxSeeds)
+		{
+			numSeeds = -1;
+			break;
+		}
+		for (j=0; j < numImages; j++)
+			seeds[numSeeds++] = images[j].position;
+	}
+	free(images);
+	return numSeeds;
+}
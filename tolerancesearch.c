@@ -0,0 +1,338 @@
+/*
+ * tolerancesearch.c
+ * Image search refined in order of area uncertainty until a target accuracy.
+ *
+ * Copyright (c) 2009, Paul Chote
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "typedefs.h"
+#include "searchgrid.h"
+#include "tolerancesearch.h"
+#include "searchstats.h"
+#include "arena.h"
+
+/*
+ * An undecided cell, whose image area is estimated as estimate, give or take
+ * uncertainty
+ */
+typedef struct pendingCell {
+	double estimate;
+	double uncertainty;
+	searchGrid grid;
+} pendingCell;
+
+/*
+ * Max-heap of undecided cells by uncertainty, with the running totals.
+ * Also totals the area of cells decided to lie inside the source, and the
+ * estimates and uncertainties of undecided cells that have reached the
+ * resolution
+ */
+typedef struct cellQueue {
+	pendingCell *cells;
+	int count;
+	int capacity;
+	double estimate;
+	double uncertainty;
+	double insideArea;
+	double resolvedEstimate;
+	double resolvedUncertainty;
+} cellQueue;
+
+/*
+ * Adds a cell to the queue. Returns FALSE if out of memory
+ */
+static boolean pushCell(cellQueue *queue, searchGrid grid, double estimate, double uncertainty)
+{
+	if (queue->count == queue->capacity)
+	{
+		int newCapacity = (queue->capacity > 0) ? 2*queue->capacity : 256;
+		pendingCell *cells = realloc(queue->cells, newCapacity*sizeof(pendingCell));
+		if (cells == NULL)
+			return FALSE;
+		queue->cells = cells;
+		queue->capacity = newCapacity;
+	}
+	
+	pendingCell cell;
+	cell.estimate = estimate;
+	cell.uncertainty = uncertainty;
+	cell.grid = grid;
+	queue->estimate += estimate;
+	queue->uncertainty += uncertainty;
+	
+	int i = queue->count++;
+	while (i > 0 && queue->cells[(i - 1)/2].uncertainty < cell.uncertainty)
+	{
+		queue->cells[i] = queue->cells[(i - 1)/2];
+		i = (i - 1)/2;
+	}
+	queue->cells[i] = cell;
+	return TRUE;
+}
+
+/*
+ * Removes and returns the cell with the largest uncertainty
+ */
+static searchGrid popCell(cellQueue *queue)
+{
+	pendingCell top = queue->cells[0];
+	pendingCell last = queue->cells[--queue->count];
+	queue->estimate -= top.estimate;
+	queue->uncertainty -= top.uncertainty;
+	
+	int i = 0;
+	for (;;)
+	{
+		int child = 2*i + 1;
+		if (child >= queue->count)
+			break;
+		if (child + 1 < queue->count && queue->cells[child + 1].uncertainty > queue->cells[child].uncertainty)
+			child++;
+		if (queue->cells[child].uncertainty <= last.uncertainty)
+			break;
+		queue->cells[i] = queue->cells[child];
+		i = child;
+	}
+	if (queue->count > 0)
+		queue->cells[i] = last;
+	return top.grid;
+}
+
+static void examineCell(searchGrid grid, cellQueue *queue);
+
+/*
+ * Divides a cell at once, for when the queue cannot grow
+ */
+static void divideCell(searchGrid grid, cellQueue *queue)
+{
+	int i;
+	for (i=0; i < 4; i++)
+		examineCell(childGrid(grid, i), queue);
+}
+
+/*
+ * Adds an undecided cell that has reached the resolution, as a leaf cell
+ */
+static void addUndecidedLeaf(searchGrid grid, cellQueue *queue, intersectionType hit, double estimate, double uncertainty)
+{
+	addLeafCell(grid, hit);
+	queue->resolvedEstimate += estimate;
+	queue->resolvedUncertainty += uncertainty;
+}
+
+/*
+ * Queues an undecided cell, or adds it as a leaf cell at the resolution. If
+ * the queue cannot grow, the cell is divided at once
+ */
+static void addUndecidedCell(searchGrid grid, cellQueue *queue, intersectionType hit, double estimate, double uncertainty)
+{
+	if (gridAtResolution(grid))
+		addUndecidedLeaf(grid, queue, hit, estimate, uncertainty);
+	else if (!pushCell(queue, grid, estimate, uncertainty))
+		divideCell(grid, queue);
+}
+
+/*
+ * Estimates the part of a cell of the given area whose image lies inside the
+ * source, from its mapped boundary vt, which has samples on both sides of the
+ * source limb. Over a small cell the mapping is nearly linear and the limb
+ * nearly straight, so the distance from the limb varies linearly across the
+ * cell, from depth inside at one corner to height outside at another. The
+ * inside fraction is then between t = depth/(depth + height) (limb parallel
+ * to a side) and 2t^2 (limb along a diagonal), for t <= 1/2 and symmetrically
+ * above. The curvature of the limb over the extent w of the image moves it by
+ * up to w^2/8r from the straight line, a fraction w/8r of the image, which
+ * widens the range.
+ */
+static void sliverEstimate(point *vt, int vC, source *source, double area, double *estimate, double *uncertainty)
+{
+	double depth = 0, height = 0;
+	double minU = vt[0].x, maxU = vt[0].x, minV = vt[0].y, maxV = vt[0].y;
+	int i;
+	for (i=0; i < vC; i++)
+	{
+		double d = hypot(vt[i].x - source->origin.x, vt[i].y - source->origin.y) - source->radius;
+		depth = (-d > depth) ? -d : depth;
+		height = (d > height) ? d : height;
+		minU = fmin(minU, vt[i].x);
+		maxU = fmax(maxU, vt[i].x);
+		minV = fmin(minV, vt[i].y);
+		maxV = fmax(maxV, vt[i].y);
+	}
+	
+	// An edge crossing the source with every sample outside gives no depth to go on
+	if (depth == 0 || height == 0)
+		return;
+	
+	double t = depth/(depth + height);
+	double s = (t < 0.5) ? t : 1 - t;
+	double low = 2*s*s;
+	double high = s;
+	double curvature = fmax(maxU - minU, maxV - minV)/(8*source->radius);
+	low = fmax(low - curvature, 0);
+	high = fmin(high + curvature, 0.5);
+	
+	double fraction = (low + high)/2;
+	*estimate = area*((t < 0.5) ? fraction : 1 - fraction);
+	*uncertainty = fmin(area*(high - low)/2, area/2);
+}
+
+/*
+ * Finds how the image of a cell intersects the source, as mapsToSource()
+ * does. Cells overlapping the source limb get an estimate of their image area
+ * and its uncertainty; others keep half the cell, give or take half.
+ */
+static intersectionType mapCellEstimate(searchGrid grid, double *estimate, double *uncertainty)
+{
+	double area = grid.searchArea.size*grid.searchArea.size;
+	*estimate = *uncertainty = area/2;
+	
+	double minU, minV, maxU, maxV;
+	boundGridImage(grid, &minU, &minV, &maxU, &maxV);
+	if (boxClearOfSource(minU, minV, maxU, maxV, grid.source))
+		return NO_OVERLAP;
+	
+	arenaMark mark = arenaGetMark(grid.context->arena);
+	point *vt;
+	int vC = mapBoundary(grid, &vt);
+	intersectionType hit = OVERLAP;
+	if (vC > 0)
+	{
+		hit = testPolygonAgainstSource(vt, vC, grid.source);
+		if (hit == OVERLAP)
+			sliverEstimate(vt, vC, grid.source, area, estimate, uncertainty);
+	}
+	arenaRelease(grid.context->arena, mark);
+	return hit;
+}
+
+/*
+ * Classifies a cell as search() does, except that cells which would be
+ * divided are queued instead, and undecided cells at the resolution (those
+ * search() discards on a lens or critical curve as well) count as their
+ * estimated image area. Cells on a critical curve whose image bound misses
+ * the source are decided at once. If the queue cannot grow, the cell is
+ * divided at once
+ */
+static void examineCell(searchGrid grid, cellQueue *queue)
+{
+	double area = grid.searchArea.size*grid.searchArea.size;
+	countCell(grid, STAT_VISITED);
+	
+	if (grid.checkLenses)
+	{
+		if (containsLens(grid))
+		{
+			countCell(grid, STAT_LENS);
+			addUndecidedCell(grid, queue, OVERLAP, area/2, area/2);
+			return;
+		}
+		grid.checkLenses = FALSE;
+	}
+	
+	if (grid.checkCriticalCurve)
+	{
+		if (straddlesCriticalCurve(grid))
+		{
+			countCell(grid, STAT_CRITICAL_CURVE);
+			
+			// Most of the critical curve is far from the images, and its cells need not be divided
+			double minU, minV, maxU, maxV;
+			boundGridImage(grid, &minU, &minV, &maxU, &maxV);
+			if (boxClearOfSource(minU, minV, maxU, maxV, grid.source))
+				addLeafCell(grid, NO_OVERLAP);
+			else
+				addUndecidedCell(grid, queue, OVERLAP, area/2, area/2);
+			return;
+		}
+		grid.checkCriticalCurve = FALSE;
+	}
+	
+	double estimate, uncertainty;
+	intersectionType hit = mapCellEstimate(grid, &estimate, &uncertainty);
+	grid.context->calculations[grid.level] += 40;
+	
+	if (hit == NO_OVERLAP || hit == INSIDE_SOURCE)
+	{
+		addLeafCell(grid, hit);
+		if (hit == INSIDE_SOURCE)
+			queue->insideArea += area;
+	}
+	else
+		addUndecidedCell(grid, queue, hit, estimate, uncertainty);
+}
+
+/*
+ * Finds the images of a source inside a given area to a target relative
+ * error, rather than dividing every undecided cell to the resolution.
+ * Undecided cells (those overlapping the source boundary, a critical curve or
+ * a lens) count as an estimate of their image area, give or take an
+ * uncertainty: for cells on the source boundary these come from how deep
+ * their mapped boundary reaches into and out of the source, and for the rest
+ * they are half the cell. Cells are divided largest uncertainty first until
+ * the sum of the uncertainties is at most relativeError times the total area,
+ * or every undecided cell has reached the resolution, which remains the
+ * finest division. If areaError is not NULL it receives the remaining
+ * uncertainty in the area. If converged is not NULL it is set to FALSE when
+ * the resolution stopped the search short of the target error.
+ * Results are accumulated into a cleared context; returns the total image area
+ */
+double searchImagesTolerance(searchArea a, source *source, event *event, searchContext *context, double relativeError,
+	double *areaError, boolean *converged)
+{
+	cellQueue queue;
+	memset(&queue, 0, sizeof(cellQueue));
+	
+	beginSearch(a, event, context);
+	examineCell(makeSearchGrid(a, source, event, context, TRUE, TRUE, 1), &queue);
+	
+	double uncertainty = queue.uncertainty + queue.resolvedUncertainty;
+	double estimate = queue.estimate + queue.resolvedEstimate;
+	while (queue.count > 0 && uncertainty > relativeError*(queue.insideArea + estimate))
+	{
+		divideCell(popCell(&queue), &queue);
+		uncertainty = queue.uncertainty + queue.resolvedUncertainty;
+		estimate = queue.estimate + queue.resolvedEstimate;
+	}
+	
+	// Record the cells left undecided
+	int k;
+	for (k=0; k < queue.count; k++)
+		addLeafCell(queue.cells[k].grid, OVERLAP);
+	
+	context->imageArea = queue.insideArea + estimate;
+	if (areaError != NULL)
+		*areaError = uncertainty;
+	if (converged != NULL)
+		*converged = (uncertainty <= relativeError*context->imageArea);
+	
+	free(queue.cells);
+	endSearch(context);
+	return context->imageArea;
+}
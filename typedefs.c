@@ -29,9 +29,7 @@
 #include <math.h>
 #include <stdio.h>
 #include "typedefs.h"
-#include <cpgplot.h>
-
-extern boolean debugMode;
+#include "deflection.h"
 
 /*
  * Creates a point with given parameters.
@@ -97,15 +95,18 @@ searchArea makeSearchArea(double x, double y, double size)
 /*
  * Creates a searchGrid with given parameters.
  */
-searchGrid makeSearchGrid(searchArea a, source *source, event *event, boolean checkLenses, boolean checkCriticalCurve, int level)
+searchGrid makeSearchGrid(searchArea a, source *source, event *event, searchContext *context, boolean checkLenses, boolean checkCriticalCurve, int level)
 {
 	searchGrid s;
 	s.searchArea = a;
 	s.source = source;
 	s.event = event;
+	s.context = context;
 	s.checkLenses = checkLenses;
 	s.checkCriticalCurve = checkCriticalCurve;
 	s.level = level;
+	s.ix = 0;
+	s.iy = 0;
 	return s;
 }
 
@@ -133,6 +134,7 @@ lens makeLens(point origin, double mass)
 
 /*
  * Creates an event with given parameters.
+ * The lens array is copied for the deflection kernels; release it with freeEvent()
  */
 event makeEvent(int numLenses, lens *lenses, double resolution)
 {
@@ -140,6 +142,11 @@ event makeEvent(int numLenses, lens *lenses, double resolution)
 	e.numLenses = numLenses;
 	e.lenses = lenses;
 	e.resolution = resolution;
+	e.lensX = e.lensY = e.lensMass = NULL;
+	e.openingAngle = 0;
+	e.lensTree = NULL;
+	e.criticalCurves = NULL;
+	updateLensArrays(&e);
 	return e;
 }
 
@@ -164,100 +171,6 @@ double lensJacobianContribution(lens l, point p, int type)
 	}
 }
 
-/*
- * Determines whether the source is inside, outside, or near the boundary of a given polygon
- */
-intersectionType newTestPolygonAgainstSource(point *v, int vC, source *source)
-{
-	boolean totallyInsideSource = TRUE;
-	boolean partiallyInsideSource = FALSE;
-	int windingNumber = 0;
-	
-	int i;
-	for(i=0;i<vC;i++)
-	{
-		/*
-		 * New Algorithm:
-		 * Check each vertex for three things:
-		 *	1) Does it lie inside the source?
-		 *		If yes, and at least one other vertex lies outside the source, 
-		 *		then the polygon overlaps the source disk and we return OVERLAP
-		 *
-		 *	2) Is the vertex "close" to the source?
-		 *		By close, do we mean "is there any chance that the source disk 
-		 *		intersects the polygon on an edge between two vertices?".
-		 *		Take a circular region around each vertex of radius equal to the 
-		 *		distance to the next vertex. If the source disk intersects this 
-		 *		boundary, we should subdivide the polygon and check again.
-		 *
-		 *	3) Does the source lie totally inside the polygon?
-		 *		We check this by calculating the "winding number" of the point wrt
-		 *		the polygon. For each edge of the polygon that lies on the right 
-		 *		of the centre of the source, increment the winding number if the
-		 *		edge points upwards, decrement it if it points downward.
-		 *		If the winding number is non-zero, then the source is inside the polygon.
-		 */
-		
-		point tv = v[i]; // This vertex
-		point nv = v[(i+1)%vC]; // Next vertex
-		point sp = source->origin; // Source position
-		
-		if (lineOnRightOfPoint( tv, nv, sp ))
-		{
-			if (tv.y > sp.y && nv.y <= sp.y) // Downward crossing
-				windingNumber--;
-			else if (tv.y <= sp.y && nv.y > sp.y) // Upward crossing
-				windingNumber++;
-		}
-		
-		// Find distance between vertex and source
-		double vd = hypot(v[i].x-source->origin.x,v[i].y-source->origin.y);
-
-		// Is vertex inside source?
-		if (vd <= source->radius)
-		{
-			partiallyInsideSource = TRUE;
-			if (!totallyInsideSource)
-			{
-				return OVERLAP;
-			}
-			continue;
-		}
-		else
-		{
-			totallyInsideSource = FALSE;
-			if (partiallyInsideSource)
-			{
-				return OVERLAP;
-			}
-		}
-		
-		// Is source near the edge of the polygon?
-	
-		// Distance to the next vertex
-		double nvd = hypot(v[i].x - v[(i+1)%vC].x,v[i].y - v[(i+1)%vC].y);
-
-		// Does the source disk intersect this disk?
-		if (vd <= source->radius+nvd)
-		{
-			//printf("nearby\n");
-			return OVERLAP;
-		}
-	}
-	
-	// If all vertices are inside source, then so is polygon
-	if (totallyInsideSource)			{
-		return INSIDE_SOURCE;
-	}
-
-	// Is source inside or outside the polygon?
-	if (windingNumber != 0)
-	{
-		return ENCLOSES_SOURCE;
-	}	
-	return NO_OVERLAP;
-}
-
 /*
  * Check whether a line (defined by v0 and v1) lies to the left or right of a point 
  * If the line is horizontal, define the point to be left if it is below or on the edge, right if it is above
@@ -273,91 +186,82 @@ boolean lineOnRightOfPoint(point v0, point v1, point p)
 }
 
 /*
- * Find where a given source disk lies in relation to a given polygon
+ * Find where a given source disk lies in relation to a given polygon.
+ * Only squared distances are compared, and the edge loop has no branches or
+ * divisions, so every edge costs a handful of multiplications.
  */
 intersectionType testPolygonAgainstSource(point *v, int vp, source *source)
 {
+	double sx = source->origin.x;
+	double sy = source->origin.y;
+	double r2 = source->radius*source->radius;
 	
-	// for each vertex, check if it is inside the source.	
-	boolean polygonEnclosedInSource = TRUE;
-	boolean hit = FALSE;
-	int edgeHits = 0;
+	// With no vertices there is nothing outside the source
+	if (vp <= 0)
+		return INSIDE_SOURCE;
 	
-	// for each vertex, check if it is inside the source.
+	// Bounding box of the polygon
+	double minX = v[0].x, maxX = v[0].x;
+	double minY = v[0].y, maxY = v[0].y;
 	int i;
-	for(i=0;i<vp;i++)
+	for (i=1; i < vp; i++)
 	{
-		// calculate distance between vertex and centre of source object
-		double vd =  hypot(v[i].x-source->origin.x,v[i].y-source->origin.y);
-		
-		// is vertex inside source object?
-		if (vd <= source->radius)
-			hit = TRUE;
-		else
-			polygonEnclosedInSource = FALSE;
+		minX = (v[i].x < minX) ? v[i].x : minX;
+		maxX = (v[i].x > maxX) ? v[i].x : maxX;
+		minY = (v[i].y < minY) ? v[i].y : minY;
+		maxY = (v[i].y > maxY) ? v[i].y : maxY;
 	}
 	
-	// If all vertices are inside source, then so is polygon
-	if (polygonEnclosedInSource) return INSIDE_SOURCE;
-	// otherwise, if at lest one is inside, the grid partially overlaps the source
-	if (hit) return OVERLAP;
+	// If the box misses the source, so does the polygon, and the source centre lies outside it
+	double gapX = (sx < minX) ? minX - sx : ((sx > maxX) ? sx - maxX : 0);
+	double gapY = (sy < minY) ? minY - sy : ((sy > maxY) ? sy - maxY : 0);
+	if (gapX*gapX + gapY*gapY > r2)
+		return NO_OVERLAP;
 	
-	// Need to check if source is inside grid, or crosses an edge
-	// group the vertices into line segments - each vertex is a part of 2 lines
-	for (i=0;i<vp;i++)
+	// Count the vertices inside the source
+	int inside = 0;
+	for (i=0; i < vp; i++)
 	{
-		// coordinates for the line end-points
-		double u1 = v[i].x;
-		double v1 = v[i].y;
-		
-		// loop the index back to zero once it reaches the end of the array so that we 
-		//  can check the final line segment between the last point and the first point
-		double u2 = v[(i+1) % vp].x;
-		double v2 = v[(i+1) % vp].y;
-		
-		// commonly used expressions
-		double du = u2 - u1;
-		double dv = v2 - v1;
-		double dux = u1 - source->origin.x;
-		double dvy = v1 - source->origin.y;
-		
-		// check if ray from (x, +inf) to (x, y) hits this edge (the strict less than in x1 is to ensure that if a vertex is exactly source, it only gets counted once)
-		double p = -dux/du;
-		if (0 < p && p <= 1 && (v1 + p*dv >= source->origin.y))
-			edgeHits++;
-		
-		// check if edge intersects source
-		
-		// coefficients of quadratic equation in p (the parameter describing where on the line segment the line crosses the source
-		double a = du*du+dv*dv;
-		double b = 2*(du*dux+dv*dvy);
-		double c = dux*dux+dvy*dvy-source->radius*source->radius;
-		
-		// discriminant
-		double d = b*b-4*a*c;
-		
-		// no solution if discriminant is negative
-		if (d < 0)
-			continue;
-		
-		// find solutions for p and check if it is on the line segment (0 <= p <=1)
-		double p1 = (-b + sqrt(d))/(2*a);
-		double p2 = (-b - sqrt(d))/(2*a);
-		
-		// If an edge is hit, there is an overlap; no need to continue
-		if (( 0 <= p1 && p1 <= 1) || (0 <= p2 && p2 <= 1))
-			return OVERLAP;
+		double dx = v[i].x - sx;
+		double dy = v[i].y - sy;
+		inside += (dx*dx + dy*dy <= r2);
 	}
+	if (inside == vp)
+		return INSIDE_SOURCE;
+	if (inside > 0)
+		return OVERLAP;
 	
-	// e encloses source if there is no overlap and the test ray intersects an odd number of edges
-	if ((edgeHits % 2) && !hit)
+	// All vertices are outside, so an edge meets the source only if the point of it
+	// nearest the centre lies between its ends and within the radius. In coordinates
+	// about the centre, with edge a->b, d = b - a and t = -a.d/d.d that is
+	// 0 < t < 1 and |a|^2 - (a.d)^2/d.d <= r^2.
+	// Alongside, count the edges crossed by the ray upwards from the centre, taking
+	// each edge as half open in x so that a vertex on the ray is counted once.
+	int near = 0;
+	int crossings = 0;
+	double ax = v[vp - 1].x - sx;
+	double ay = v[vp - 1].y - sy;
+	for (i=0; i < vp; i++)
 	{
-		return ENCLOSES_SOURCE;
+		double bx = v[i].x - sx;
+		double by = v[i].y - sy;
+		double dx = bx - ax;
+		double dy = by - ay;
+		double along = -(ax*dx + ay*dy);
+		double length2 = dx*dx + dy*dy;
+		near |= (along > 0) & (along < length2) & ((ax*ax + ay*ay - r2)*length2 <= along*along);
+		
+		// The edge meets x = 0 at y = (ay*bx - ax*by)/dx
+		double cross = ay*bx - ax*by;
+		crossings += ((ax > 0) != (bx > 0)) & (cross*dx >= 0);
+		
+		ax = bx;
+		ay = by;
 	}
-	//if (!hit && pointInPolygon(source->origin, v, vp))
-	//	return ENCLOSES_SOURCE;
 	
-	if (hit) return OVERLAP;
+	if (near)
+		return OVERLAP;
 	
-	return NO_OVERLAP;
+	// The source is enclosed if the ray crosses an odd number of edges
+	return (crossings & 1) ? ENCLOSES_SOURCE : NO_OVERLAP;
 }
@@ -29,6 +29,8 @@
 #ifndef TYPEDEFS_HEADER
 #define TYPEDEFS_HEADER
 
+#include <stdint.h>
+
 typedef char boolean;
 #define TRUE 1
 #define FALSE 0
@@ -69,19 +71,88 @@ typedef struct source {
 	double radius;
 } source;
 
+struct lensTree;
+struct criticalCurves;
+
 typedef struct event {
 	int numLenses;
 	lens *lenses;
 	double resolution;
+	
+	// Structure-of-arrays copy of the lenses, used by the deflection kernels
+	double *lensX;
+	double *lensY;
+	double *lensMass;
+	
+	// Barnes-Hut tree used instead of the direct sum when openingAngle > 0
+	double openingAngle;
+	struct lensTree *lensTree;
+	
+	// Critical curves and caustics, traced when first needed
+	struct criticalCurves *criticalCurves;
 } event;
 
+#define MAX_SEARCH_LEVELS 64
+
+// A leaf cell of a search, at (ix, iy) on the lattice of its level below the searched area
+typedef struct imageCell {
+	uint64_t ix;
+	uint64_t iy;
+	unsigned char level;
+	unsigned char type;		// intersectionType
+} imageCell;
+
+struct searchTasks;
+struct edgeCache;
+struct jacobianCache;
+struct scratchArena;
+struct searchStats;
+
+typedef struct searchContext {
+	double imageArea;
+	double eliminated[MAX_SEARCH_LEVELS];
+	int calculations[MAX_SEARCH_LEVELS];
+	long deflections;
+	long jacobianEvaluations;
+	boolean recordCells;
+	imageCell *cells;
+	int numCells;
+	int maxCells;
+	
+	// Area of the last search, whose lattice the cells are placed on
+	searchArea root;
+	
+	// Cell edges already mapped into the source plane during this search
+	struct edgeCache *cache;
+	
+	// Scratch memory for mapping cell boundaries
+	struct scratchArena *arena;
+	
+	// Jacobian signs at cell corners, kept between searches with the same lenses
+	struct jacobianCache *jacobians;
+	struct jacobianCache **workerJacobians;
+	int numWorkerJacobians;
+	
+	// When set, children on splitLevel are deferred as a task instead of searched
+	struct searchTasks *tasks;
+	int splitLevel;
+	
+	// Statistics of each search, when not NULL (owned by the caller)
+	struct searchStats *stats;
+} searchContext;
+
 typedef struct searchGrid {
 	event *event;
 	source *source;
+	searchContext *context;
 	searchArea searchArea;
 	boolean checkLenses;
 	boolean checkCriticalCurve;
 	int level;
+	
+	// Position of the cell on the 2^(level-1) x 2^(level-1) lattice of its level
+	uint64_t ix;
+	uint64_t iy;
 } searchGrid;
 
 point makePoint(double x, double y);
@@ -89,7 +160,7 @@ boolean pointInArea(point p, searchArea a);
 point interpolatePosition(point startPoint, point endPoint, double ratio);
 point areaCorner(searchArea a, corner c);
 searchArea makeSearchArea(double x, double y, double size);
-searchGrid makeSearchGrid(searchArea a, source *source, event *event, boolean checkLenses, boolean checkCriticalCurve, int level);
+searchGrid makeSearchGrid(searchArea a, source *source, event *event, searchContext *context, boolean checkLenses, boolean checkCriticalCurve, int level);
 source makeSource(point origin, double radius);
 lens makeLens(point origin, double mass);
 event makeEvent(int numLenses, lens *lenses, double resolution);